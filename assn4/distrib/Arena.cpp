@@ -0,0 +1,54 @@
+#include "Arena.h"
+
+Arena::Arena( size_t blockSize ) :
+    blockSize( blockSize ), current( NULL ), remaining( 0 ), used( 0 )
+{
+}
+
+Arena::~Arena()
+{
+    clear();
+}
+
+void Arena::clear()
+{
+    for( size_t i = destructors.size(); i > 0; i-- )
+    {
+        destructors[ i - 1 ].destroy( destructors[ i - 1 ].obj );
+    }
+    destructors.clear();
+    for( unsigned int i = 0; i < blocks.size(); i++ )
+    {
+        operator delete[]( blocks[i], std::align_val_t( CACHE_LINE ) );
+    }
+    blocks.clear();
+    current = NULL;
+    remaining = 0;
+    used = 0;
+}
+
+void* Arena::allocate( size_t size, size_t align )
+{
+    // blocks start on a cache line, which covers every alignment we see
+    if( size > blockSize / 4 )
+    {
+        // large requests get their own block and leave the current one alone
+        char* block = ( char* )operator new[]( size, std::align_val_t( CACHE_LINE ) );
+        blocks.push_back( block );
+        used += size;
+        return block;
+    }
+    size_t padding = ( align - ( size_t )current % align ) % align;
+    if( current == NULL || padding + size > remaining )
+    {
+        current = ( char* )operator new[]( blockSize, std::align_val_t( CACHE_LINE ) );
+        blocks.push_back( current );
+        remaining = blockSize;
+        padding = 0;
+    }
+    void* ptr = current + padding;
+    current += padding + size;
+    remaining -= padding + size;
+    used += size;
+    return ptr;
+}
@@ -0,0 +1,87 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+///Bump allocator that owns a set of objects and frees them all at once.
+///Memory comes in large cache-line-aligned blocks and objects are placed
+///one after the other in creation order, so objects created together,
+///such as the children of a group, end up next to each other.
+///Destructors are recorded for types that have one and run in reverse
+///creation order by clear() or by the arena's destructor.
+class Arena
+{
+public:
+
+    static const size_t CACHE_LINE = 64;
+
+    ///@param blockSize bytes per block; larger requests get a block of their own
+    Arena( size_t blockSize = 256 * 1024 );
+    ~Arena();
+
+    ///destroys every object and releases all blocks
+    void clear();
+
+    ///raw memory, aligned to align (a power of two)
+    void* allocate( size_t size, size_t align );
+
+    template< class T, class... Args >
+    T* create( Args&&... args )
+    {
+        T* obj = new( allocate( sizeof( T ), alignof( T ) ) ) T( std::forward< Args >( args )... );
+        if( !std::is_trivially_destructible< T >::value )
+        {
+            destructors.push_back( Destructor{ obj, &destroy< T > } );
+        }
+        return obj;
+    }
+
+    ///array of count default-constructed elements, for plain types
+    template< class T >
+    T* createArray( int count )
+    {
+        static_assert( std::is_trivially_destructible< T >::value, "arena arrays are never destroyed" );
+        T* array = ( T* )allocate( sizeof( T ) * ( count > 0 ? count : 1 ), alignof( T ) );
+        for( int i = 0; i < count; i++ )
+        {
+            new( array + i ) T();
+        }
+        return array;
+    }
+
+    ///bytes handed out so far
+    size_t getUsed() const
+    {
+        return used;
+    }
+
+private:
+
+    struct Destructor
+    {
+        void* obj;
+        void ( *destroy )( void* );
+    };
+
+    template< class T >
+    static void destroy( void* obj )
+    {
+        ( ( T* )obj )->~T();
+    }
+
+    Arena( const Arena& );
+    Arena& operator = ( const Arena& );
+
+    size_t blockSize;
+    std::vector< char* > blocks;
+    char* current;
+    size_t remaining;
+    size_t used;
+    std::vector< Destructor > destructors;
+};
+
+#endif // ARENA_H
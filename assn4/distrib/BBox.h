@@ -0,0 +1,130 @@
+#ifndef BBOX_H
+#define BBOX_H
+
+#include <vecmath.h>
+#include <float.h>
+#include "Ray.h"
+#include "RayPacket.h"
+#include "VecUtils.h"
+
+// Axis-aligned bounding box.
+// A default constructed box is empty and grows with extend().
+class BBox
+{
+public:
+
+    BBox()
+    {
+        minCorner = Vector3f( FLT_MAX );
+        maxCorner = Vector3f( -FLT_MAX );
+    }
+
+    BBox( const Vector3f& a, const Vector3f& b )
+    {
+        minCorner = VecUtils::min( a, b );
+        maxCorner = VecUtils::max( a, b );
+    }
+
+    const Vector3f& getMin() const
+    {
+        return minCorner;
+    }
+
+    const Vector3f& getMax() const
+    {
+        return maxCorner;
+    }
+
+    bool isEmpty() const
+    {
+        return minCorner[0] > maxCorner[0];
+    }
+
+    void extend( const Vector3f& p )
+    {
+        minCorner = VecUtils::min( minCorner, p );
+        maxCorner = VecUtils::max( maxCorner, p );
+    }
+
+    void extend( const BBox& b )
+    {
+        minCorner = VecUtils::min( minCorner, b.minCorner );
+        maxCorner = VecUtils::max( maxCorner, b.maxCorner );
+    }
+
+    Vector3f getCentroid() const
+    {
+        return 0.5f * ( minCorner + maxCorner );
+    }
+
+    Vector3f getExtent() const
+    {
+        return maxCorner - minCorner;
+    }
+
+    float surfaceArea() const
+    {
+        if( isEmpty() )
+        {
+            return 0;
+        }
+        Vector3f e = getExtent();
+        return 2 * ( e[0] * e[1] + e[1] * e[2] + e[2] * e[0] );
+    }
+
+    // index of the longest axis
+    int maxExtent() const
+    {
+        Vector3f e = getExtent();
+        if( e[0] > e[1] && e[0] > e[2] )
+        {
+            return 0;
+        }
+        return ( e[1] > e[2] ) ? 1 : 2;
+    }
+
+    // slab test against the parameter interval [tmin, tmax], using the
+    // reciprocal direction and signs the ray precomputes
+    bool intersect( const Ray& r, float tmin, float tmax ) const
+    {
+        const Vector3f& o = r.getOrigin();
+        const float* invDir = r.getInvDirection();
+        for( int i = 0; i < 3; ++i )
+        {
+            float lo = minCorner[i], hi = maxCorner[i];
+            float t0 = ( ( r.getSign( i ) ? hi : lo ) - o[i] ) * invDir[i];
+            float t1 = ( ( r.getSign( i ) ? lo : hi ) - o[i] ) * invDir[i];
+            tmin = t0 > tmin ? t0 : tmin;
+            tmax = t1 < tmax ? t1 : tmax;
+            if( tmin > tmax )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+#ifdef RT_USE_SSE
+    ///slab test for all rays of a packet
+    ///@return bit i is set if ray i overlaps the box within its interval
+    int intersect( const RayPacket& p, __m128 tmin, __m128 tmax ) const
+    {
+        for( int i = 0; i < 3; ++i )
+        {
+            __m128 t0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( minCorner[i] ), p.o[i] ), p.invD[i] );
+            __m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( maxCorner[i] ), p.o[i] ), p.invD[i] );
+            tmin = _mm_max_ps( tmin, _mm_min_ps( t0, t1 ) );
+            tmax = _mm_min_ps( tmax, _mm_max_ps( t0, t1 ) );
+        }
+        return _mm_movemask_ps( _mm_cmple_ps( tmin, tmax ) );
+    }
+#endif
+
+private:
+
+    Vector3f minCorner;
+    Vector3f maxCorner;
+
+};
+
+#endif // BBOX_H
@@ -0,0 +1,1423 @@
+#include "BVH.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cmath>
+#include <memory>
+#include <stdint.h>
+
+// relative cost of visiting a node compared to testing a primitive
+#define BVH_TRAVERSAL_COST 1.0f
+// below this depth splits stop using the SAH and cut at the median,
+// so the traversal stack can never overflow
+#define BVH_SAH_DEPTH ( BVH::MAX_DEPTH / 2 )
+// centroid bins per axis
+#define BVH_NUM_BINS 32
+// subtrees with fewer primitives are built by the thread that made them
+#define BVH_TASK_SIZE 4096
+// nodes with more primitives bin in parallel
+#define BVH_PARALLEL_BIN_SIZE ( 1 << 16 )
+#define BVH_BIN_CHUNK ( 1 << 14 )
+// Morton codes use 10 bits per axis up to this many primitives, 21 above
+#define BVH_MORTON_30_MAX ( 1 << 18 )
+// leaves of a treelet, and the smallest subtree that gets restructured
+#define BVH_TREELET_SIZE 7
+#define BVH_TREELET_MIN_PRIMS 8
+// spatial splits may add at most this fraction of extra references
+#define BVH_SPATIAL_BUDGET 0.3f
+// and are only tried where the object split children overlap by more
+// than this fraction of the root area
+#define BVH_SPATIAL_ALPHA 1e-5f
+
+namespace
+{
+    // the builder works on plain floats: vecmath's accessors are out of
+    // line and would otherwise dominate the bin loops
+    struct Box
+    {
+        float lo[3];
+        float hi[3];
+
+        Box()
+        {
+            for( int k = 0; k < 3; k++ )
+            {
+                lo[k] = FLT_MAX;
+                hi[k] = -FLT_MAX;
+            }
+        }
+
+        void extend( const Box& b )
+        {
+            for( int k = 0; k < 3; k++ )
+            {
+                lo[k] = std::min( lo[k], b.lo[k] );
+                hi[k] = std::max( hi[k], b.hi[k] );
+            }
+        }
+
+        void extend( const float* p )
+        {
+            for( int k = 0; k < 3; k++ )
+            {
+                lo[k] = std::min( lo[k], p[k] );
+                hi[k] = std::max( hi[k], p[k] );
+            }
+        }
+
+        float surfaceArea() const
+        {
+            if( lo[0] > hi[0] )
+            {
+                return 0;
+            }
+            float x = hi[0] - lo[0], y = hi[1] - lo[1], z = hi[2] - lo[2];
+            return 2 * ( x * y + y * z + z * x );
+        }
+
+        BBox toBBox() const
+        {
+            return BBox( Vector3f( lo[0], lo[1], lo[2] ), Vector3f( hi[0], hi[1], hi[2] ) );
+        }
+    };
+
+    struct CentroidLess
+    {
+        int axis;
+        CentroidLess( int a ) : axis( a ) {}
+        template< class P >
+        bool operator()( const P& a, const P& b ) const
+        {
+            return a.centroid[ axis ] < b.centroid[ axis ];
+        }
+    };
+
+    struct Bin
+    {
+        Box box;
+        int count = 0;
+    };
+
+    // bounds of the primitives and of their centroids,
+    // plus the centroid bins once the centroid bounds are known
+    struct BinSet
+    {
+        Box box;
+        Box centroidBox;
+        Bin bins[3][ BVH_NUM_BINS ];
+
+        void merge( const BinSet& other )
+        {
+            box.extend( other.box );
+            centroidBox.extend( other.centroidBox );
+            for( int axis = 0; axis < 3; axis++ )
+            {
+                for( int b = 0; b < BVH_NUM_BINS; b++ )
+                {
+                    if( other.bins[ axis ][b].count > 0 )
+                    {
+                        bins[ axis ][b].box.extend( other.bins[ axis ][b].box );
+                    }
+                    bins[ axis ][b].count += other.bins[ axis ][b].count;
+                }
+            }
+        }
+    };
+
+    inline int binIndex( float c, float lo, float scale )
+    {
+        int b = ( int )( ( c - lo ) * scale );
+        return b < 0 ? 0 : ( b >= BVH_NUM_BINS ? BVH_NUM_BINS - 1 : b );
+    }
+
+    inline float exponentScale( int e )
+    {
+        return ldexpf( 1.0f, e );
+    }
+
+    // stores boxes[0, num) as the children of node, every plane on a grid
+    // of 255 steps over the union and rounded outward, so the stored boxes
+    // always contain the exact ones
+    void quantize( BVHNode& node, const Box* boxes, int num )
+    {
+        Box bounds;
+        for( int c = 0; c < num; c++ )
+        {
+            bounds.extend( boxes[c] );
+        }
+        node.numChildren = ( uint8_t )num;
+        for( int k = 0; k < 3; k++ )
+        {
+            float origin = bounds.lo[k];
+            float extent = bounds.hi[k] - origin;
+            int e = -126;
+            if( extent > 0 )
+            {
+                frexpf( extent / 255, &e );
+                e = std::max( e, -126 );
+            }
+            // the subtraction above may have rounded down
+            while( origin + 255 * exponentScale( e ) < bounds.hi[k] )
+            {
+                e++;
+            }
+            float scale = exponentScale( e );
+            node.origin[k] = origin;
+            node.exponent[k] = ( int8_t )e;
+            for( int c = 0; c < BVH_WIDTH; c++ )
+            {
+                if( c >= num )
+                {
+                    node.qlo[k][c] = 255;
+                    node.qhi[k][c] = 0;
+                    continue;
+                }
+                int lo = std::min( std::max( ( int )floorf( ( boxes[c].lo[k] - origin ) / scale ), 0 ), 255 );
+                int hi = std::min( std::max( ( int )ceilf( ( boxes[c].hi[k] - origin ) / scale ), 0 ), 255 );
+                while( lo > 0 && origin + lo * scale > boxes[c].lo[k] )
+                {
+                    lo--;
+                }
+                while( hi < 255 && origin + hi * scale < boxes[c].hi[k] )
+                {
+                    hi++;
+                }
+                node.qlo[k][c] = ( uint8_t )lo;
+                node.qhi[k][c] = ( uint8_t )hi;
+            }
+        }
+    }
+
+    Box childBox( const BVHNode& node, int c )
+    {
+        Box box;
+        for( int k = 0; k < 3; k++ )
+        {
+            float scale = exponentScale( node.exponent[k] );
+            box.lo[k] = node.origin[k] + node.qlo[k][c] * scale;
+            box.hi[k] = node.origin[k] + node.qhi[k][c] * scale;
+        }
+        return box;
+    }
+}
+
+struct BVH::BuildPrim
+{
+    Box box;
+    float centroid[3];
+    int index;
+};
+
+// node of the binary tree the builders make, collapsed into BVHNodes
+// afterwards. Nodes are depth first, the first child of an interior node
+// is the node right after it.
+struct BVH::BuildNode
+{
+    Box box;
+    int offset; // leaf: first entry in primIndices; interior: second child
+    int count;  // number of primitives in a leaf, 0 for interior nodes
+};
+
+void BVH::build( const std::vector< BBox >& primBounds, int maxLeafSize, Quality quality,
+                 const std::vector< Vector3f >* triangles )
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    nodes.clear();
+    primIndices.clear();
+    stats = BVHStats();
+    if( primBounds.empty() )
+    {
+        return;
+    }
+
+    int n = ( int )primBounds.size();
+    std::vector< BuildPrim > prims( n );
+    ThreadPool::global().parallelFor( n, BVH_BIN_CHUNK, [&]( int i ) {
+        const Vector3f& lo = primBounds[i].getMin();
+        const Vector3f& hi = primBounds[i].getMax();
+        for( int k = 0; k < 3; k++ )
+        {
+            prims[i].box.lo[k] = lo[k];
+            prims[i].box.hi[k] = hi[k];
+            prims[i].centroid[k] = 0.5f * ( lo[k] + hi[k] );
+        }
+        prims[i].index = i;
+    } );
+    if( quality == SBVH && triangles == NULL )
+    {
+        // nothing to clip
+        quality = SAH;
+    }
+    std::vector< BuildNode > binary;
+    if( quality == SBVH )
+    {
+        buildSpatial( prims, *triangles, maxLeafSize, binary );
+    }
+    else if( ( quality == LBVH || quality == LBVH_TREELET ) &&
+             !buildLinear( prims, quality == LBVH_TREELET, maxLeafSize, binary ) )
+    {
+        // too deep for the traversal stack, rare with real scenes
+        binary.clear();
+        primIndices.clear();
+    }
+    if( binary.empty() )
+    {
+        binary.reserve( 2 * n );
+        buildNode( prims, 0, n, 0, maxLeafSize, binary );
+
+        primIndices.resize( n );
+        for( int i = 0; i < n; i++ )
+        {
+            primIndices[i] = prims[i].index;
+        }
+    }
+    // a wide node replaces at least one interior binary node
+    nodes.reserve( std::max( ( int )binary.size() / 2, 1 ) );
+    collapse( binary, 0 );
+
+    computeStats();
+    stats.buildSeconds = std::chrono::duration< double >(
+        std::chrono::steady_clock::now() - start ).count();
+    if( printStats )
+    {
+        static const char* names[] = { "sah", "lbvh", "treelet", "sbvh" };
+        printf( "BVH %s: %d prims, %d refs, %d nodes, %d leaves (%d-%d, avg %.2f), depth %d, SAH %.2f, %.1f KiB, %.3f s\n",
+                names[ quality ], n, ( int )primIndices.size(), stats.numNodes, stats.numLeaves, stats.minLeafSize, stats.maxLeafSize,
+                stats.avgLeafSize, stats.maxDepth, stats.sahCost, stats.bytes / 1024.0, stats.buildSeconds );
+    }
+}
+
+void BVH::buildNode( std::vector< BuildPrim >& prims, int begin, int end,
+                     int depth, int maxLeafSize, std::vector< BuildNode >& out )
+{
+    int nodeIndex = ( int )out.size();
+    out.push_back( BuildNode() );
+    int n = end - begin;
+
+    BinSet set;
+    if( n >= BVH_PARALLEL_BIN_SIZE )
+    {
+        int chunks = ( n + BVH_BIN_CHUNK - 1 ) / BVH_BIN_CHUNK;
+        std::vector< BinSet > partial( chunks );
+        ThreadPool::global().parallelFor( chunks, 1, [&]( int c ) {
+            int e = std::min( begin + ( c + 1 ) * BVH_BIN_CHUNK, end );
+            for( int i = begin + c * BVH_BIN_CHUNK; i < e; i++ )
+            {
+                partial[c].box.extend( prims[i].box );
+                partial[c].centroidBox.extend( prims[i].centroid );
+            }
+        } );
+        for( int c = 0; c < chunks; c++ )
+        {
+            set.merge( partial[c] );
+        }
+    }
+    else
+    {
+        for( int i = begin; i < end; i++ )
+        {
+            set.box.extend( prims[i].box );
+            set.centroidBox.extend( prims[i].centroid );
+        }
+    }
+    out[ nodeIndex ].box = set.box;
+
+    float lo[3], extent[3];
+    for( int k = 0; k < 3; k++ )
+    {
+        lo[k] = set.centroidBox.lo[k];
+        extent[k] = set.centroidBox.hi[k] - lo[k];
+    }
+    int bestAxis = extent[0] > extent[1] && extent[0] > extent[2] ? 0 : ( extent[1] > extent[2] ? 1 : 2 );
+    bool makeLeaf = n == 1 || ( n <= maxLeafSize && depth >= BVH_SAH_DEPTH );
+    bool median = depth >= BVH_SAH_DEPTH;
+    int bestBin = -1;
+
+    if( !makeLeaf && !median )
+    {
+        float scale[3];
+        for( int axis = 0; axis < 3; axis++ )
+        {
+            scale[ axis ] = extent[ axis ] > 0 ? BVH_NUM_BINS / extent[ axis ] : 0;
+        }
+        if( n >= BVH_PARALLEL_BIN_SIZE )
+        {
+            int chunks = ( n + BVH_BIN_CHUNK - 1 ) / BVH_BIN_CHUNK;
+            std::vector< BinSet > partial( chunks );
+            ThreadPool::global().parallelFor( chunks, 1, [&]( int c ) {
+                int e = std::min( begin + ( c + 1 ) * BVH_BIN_CHUNK, end );
+                for( int i = begin + c * BVH_BIN_CHUNK; i < e; i++ )
+                {
+                    for( int axis = 0; axis < 3; axis++ )
+                    {
+                        Bin& bin = partial[c].bins[ axis ][ binIndex( prims[i].centroid[ axis ], lo[ axis ], scale[ axis ] ) ];
+                        bin.box.extend( prims[i].box );
+                        bin.count++;
+                    }
+                }
+            } );
+            for( int c = 0; c < chunks; c++ )
+            {
+                set.merge( partial[c] );
+            }
+        }
+        else
+        {
+            for( int i = begin; i < end; i++ )
+            {
+                for( int axis = 0; axis < 3; axis++ )
+                {
+                    Bin& bin = set.bins[ axis ][ binIndex( prims[i].centroid[ axis ], lo[ axis ], scale[ axis ] ) ];
+                    bin.box.extend( prims[i].box );
+                    bin.count++;
+                }
+            }
+        }
+
+        // sweep the bin boundaries: cost of splitting after bin b
+        float bestCost = FLT_MAX;
+        float invArea = 1.0f / set.box.surfaceArea();
+        for( int axis = 0; axis < 3; axis++ )
+        {
+            if( extent[ axis ] <= 0 )
+            {
+                continue;
+            }
+            const Bin* bins = set.bins[ axis ];
+            float rightArea[ BVH_NUM_BINS ];
+            int rightCount[ BVH_NUM_BINS ];
+            Box right;
+            int count = 0;
+            for( int b = BVH_NUM_BINS - 1; b > 0; b-- )
+            {
+                if( bins[b].count > 0 )
+                {
+                    right.extend( bins[b].box );
+                }
+                count += bins[b].count;
+                rightArea[b] = right.surfaceArea();
+                rightCount[b] = count;
+            }
+            Box left;
+            count = 0;
+            for( int b = 0; b < BVH_NUM_BINS - 1; b++ )
+            {
+                if( bins[b].count == 0 )
+                {
+                    continue;
+                }
+                left.extend( bins[b].box );
+                count += bins[b].count;
+                if( rightCount[ b + 1 ] == 0 )
+                {
+                    continue;
+                }
+                float cost = BVH_TRAVERSAL_COST +
+                    ( left.surfaceArea() * count + rightArea[ b + 1 ] * rightCount[ b + 1 ] ) * invArea;
+                if( cost < bestCost )
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+        if( bestBin < 0 )
+        {
+            // all centroids coincide, any split is as good as another
+            makeLeaf = n <= maxLeafSize;
+            median = true;
+        }
+        else if( bestCost >= ( float )( ( n + leafBlockSize - 1 ) / leafBlockSize ) && n <= maxLeafSize )
+        {
+            makeLeaf = true;
+        }
+    }
+    if( median && n <= maxLeafSize )
+    {
+        makeLeaf = true;
+    }
+
+    if( makeLeaf )
+    {
+        out[ nodeIndex ].offset = begin;
+        out[ nodeIndex ].count = n;
+        return;
+    }
+
+    int mid;
+    if( median )
+    {
+        mid = begin + n / 2;
+        std::nth_element( prims.begin() + begin, prims.begin() + mid,
+                          prims.begin() + end, CentroidLess( bestAxis ) );
+    }
+    else
+    {
+        float axisLo = lo[ bestAxis ];
+        float axisScale = BVH_NUM_BINS / extent[ bestAxis ];
+        mid = ( int )( std::partition( prims.begin() + begin, prims.begin() + end,
+            [&]( const BuildPrim& p ) {
+                return binIndex( p.centroid[ bestAxis ], axisLo, axisScale ) <= bestBin;
+            } ) - prims.begin() );
+    }
+
+    if( n >= BVH_TASK_SIZE )
+    {
+        // the second child is built as a task into its own array and
+        // appended after the first, which this thread builds in place
+        std::vector< BuildNode > second;
+        TaskGroup group;
+        ThreadPool& pool = ThreadPool::global();
+        pool.submit( group, [&]() {
+            second.reserve( 2 * ( end - mid ) );
+            buildNode( prims, mid, end, depth + 1, maxLeafSize, second );
+        } );
+        buildNode( prims, begin, mid, depth + 1, maxLeafSize, out );
+        pool.wait( group );
+
+        int base = ( int )out.size();
+        for( unsigned int i = 0; i < second.size(); i++ )
+        {
+            if( second[i].count == 0 )
+            {
+                second[i].offset += base;
+            }
+        }
+        out.insert( out.end(), second.begin(), second.end() );
+        out[ nodeIndex ].offset = base;
+    }
+    else
+    {
+        buildNode( prims, begin, mid, depth + 1, maxLeafSize, out );
+        out[ nodeIndex ].offset = ( int )out.size();
+        buildNode( prims, mid, end, depth + 1, maxLeafSize, out );
+    }
+    out[ nodeIndex ].count = 0;
+}
+
+int BVH::collapse( const std::vector< BuildNode >& binary, int b )
+{
+    int index = ( int )nodes.size();
+    nodes.push_back( BVHNode() );
+
+    // open the interior child with the largest area until the node is
+    // full; children stay in binary order
+    int children[ BVH_WIDTH ];
+    int num = 0;
+    if( binary[b].count > 0 )
+    {
+        children[ num++ ] = b;
+    }
+    else
+    {
+        children[ num++ ] = b + 1;
+        children[ num++ ] = binary[b].offset;
+    }
+    while( num < BVH_WIDTH )
+    {
+        int best = -1;
+        float bestArea = -1;
+        for( int c = 0; c < num; c++ )
+        {
+            const BuildNode& child = binary[ children[c] ];
+            if( child.count == 0 && child.box.surfaceArea() > bestArea )
+            {
+                bestArea = child.box.surfaceArea();
+                best = c;
+            }
+        }
+        if( best < 0 )
+        {
+            break;
+        }
+        int opened = children[ best ];
+        for( int c = num; c > best + 1; c-- )
+        {
+            children[c] = children[ c - 1 ];
+        }
+        children[ best ] = opened + 1;
+        children[ best + 1 ] = binary[ opened ].offset;
+        num++;
+    }
+
+    Box boxes[ BVH_WIDTH ];
+    for( int c = 0; c < num; c++ )
+    {
+        boxes[c] = binary[ children[c] ].box;
+    }
+    quantize( nodes[ index ], boxes, num );
+    for( int c = 0; c < BVH_WIDTH; c++ )
+    {
+        nodes[ index ].child[c] = -1;
+        nodes[ index ].count[c] = 0;
+    }
+    for( int c = 0; c < num; c++ )
+    {
+        const BuildNode& child = binary[ children[c] ];
+        if( child.count > 0 )
+        {
+            nodes[ index ].child[c] = child.offset;
+            nodes[ index ].count[c] = ( uint8_t )child.count;
+        }
+        else
+        {
+            // the recursion grows nodes, so no reference is held across it
+            int wide = collapse( binary, children[c] );
+            nodes[ index ].child[c] = wide;
+        }
+    }
+    return index;
+}
+
+void BVH::alignLeaves()
+{
+    std::vector< int > aligned;
+    aligned.reserve( primIndices.size() + primIndices.size() / 2 );
+    // depth first, so the leaves keep their order
+    for( unsigned int i = 0; i < nodes.size(); i++ )
+    {
+        BVHNode& node = nodes[i];
+        for( int c = 0; c < node.numChildren; c++ )
+        {
+            if( node.count[c] == 0 )
+            {
+                continue;
+            }
+            int first = ( int )aligned.size();
+            aligned.insert( aligned.end(), primIndices.begin() + node.child[c],
+                            primIndices.begin() + node.child[c] + node.count[c] );
+            while( aligned.size() % leafBlockSize != 0 )
+            {
+                aligned.push_back( aligned.back() );
+            }
+            node.child[c] = first;
+        }
+    }
+    primIndices.swap( aligned );
+    stats.bytes = nodes.size() * sizeof( BVHNode ) + primIndices.size() * sizeof( int );
+}
+
+BBox BVH::getBounds() const
+{
+    Box bounds;
+    if( !nodes.empty() )
+    {
+        for( int c = 0; c < nodes[0].numChildren; c++ )
+        {
+            bounds.extend( childBox( nodes[0], c ) );
+        }
+    }
+    return bounds.toBBox();
+}
+
+void BVH::computeStats()
+{
+    stats = BVHStats();
+    stats.numNodes = ( int )nodes.size();
+    stats.bytes = nodes.size() * sizeof( BVHNode ) + primIndices.size() * sizeof( int );
+    stats.minLeafSize = INT_MAX;
+    float invArea = 1.0f / std::max( getBounds().surfaceArea(), FLT_MIN );
+    // the root is always visited
+    float cost = BVH_TRAVERSAL_COST;
+    int depth[ STACK_SIZE + 1 ];
+    int stackSize = 0;
+    depth[ stackSize++ ] = 0;
+    // nodes are depth first, so a stack of depths replays the recursion
+    for( unsigned int i = 0; i < nodes.size(); i++ )
+    {
+        int d = depth[ --stackSize ];
+        stats.maxDepth = std::max( stats.maxDepth, d );
+        const BVHNode& node = nodes[i];
+        for( int c = 0; c < node.numChildren; c++ )
+        {
+            float area = childBox( node, c ).surfaceArea() * invArea;
+            if( node.count[c] > 0 )
+            {
+                stats.numLeaves++;
+                stats.minLeafSize = std::min( stats.minLeafSize, ( int )node.count[c] );
+                stats.maxLeafSize = std::max( stats.maxLeafSize, ( int )node.count[c] );
+                cost += area * node.count[c];
+            }
+            else
+            {
+                cost += area * BVH_TRAVERSAL_COST;
+                depth[ stackSize++ ] = d + 1;
+            }
+        }
+    }
+    stats.sahCost = cost;
+    stats.avgLeafSize = ( float )primIndices.size() / stats.numLeaves;
+}
+
+namespace
+{
+    // spreads the low 21 bits of x so two zero bits separate each
+    inline uint64_t spreadBits( uint64_t x )
+    {
+        x &= 0x1fffff;
+        x = ( x | x << 32 ) & 0x1f00000000ffffULL;
+        x = ( x | x << 16 ) & 0x1f0000ff0000ffULL;
+        x = ( x | x << 8 ) & 0x100f00f00f00f00fULL;
+        x = ( x | x << 4 ) & 0x10c30c30c30c30c3ULL;
+        x = ( x | x << 2 ) & 0x1249249249249249ULL;
+        return x;
+    }
+
+    // node of the intermediate binary tree: n - 1 interior nodes
+    // followed by n leaves, leaf j holding the j-th primitive in Morton order
+    struct LinearNode
+    {
+        Box box;
+        float cost; // SAH cost of the subtree, not normalized
+        int left;
+        int right;
+        int parent;
+        int numPrims;
+    };
+
+    struct LinearTree
+    {
+        std::vector< LinearNode > nodes;
+        std::vector< uint64_t > codes;
+        int n;
+
+        bool isLeaf( int node ) const
+        {
+            return node >= n - 1;
+        }
+
+        // length of the common prefix of keys i and j, -1 outside the
+        // array; equal codes are told apart by their index
+        int delta( int i, int j ) const
+        {
+            if( j < 0 || j >= n )
+            {
+                return -1;
+            }
+            if( codes[i] == codes[j] )
+            {
+                return 64 + __builtin_clz( ( uint32_t )i ^ ( uint32_t )j );
+            }
+            return __builtin_clzll( codes[i] ^ codes[j] );
+        }
+
+        // Karras 2012: interior node i covers a key range starting or
+        // ending at i and splits it where the common prefix grows
+        void buildInterior( int i )
+        {
+            int d = delta( i, i + 1 ) > delta( i, i - 1 ) ? 1 : -1;
+            int deltaMin = delta( i, i - d );
+            int lmax = 2;
+            while( delta( i, i + lmax * d ) > deltaMin )
+            {
+                lmax *= 2;
+            }
+            int l = 0;
+            for( int t = lmax / 2; t >= 1; t /= 2 )
+            {
+                if( delta( i, i + ( l + t ) * d ) > deltaMin )
+                {
+                    l += t;
+                }
+            }
+            int j = i + l * d;
+            int deltaNode = delta( i, j );
+            int split = 0;
+            for( int div = 2, t = l; t > 1; div *= 2 )
+            {
+                t = ( l + div - 1 ) / div;
+                if( delta( i, i + ( split + t ) * d ) > deltaNode )
+                {
+                    split += t;
+                }
+            }
+            int gamma = i + split * d + std::min( d, 0 );
+            int left = std::min( i, j ) == gamma ? n - 1 + gamma : gamma;
+            int right = std::max( i, j ) == gamma + 1 ? n - 1 + gamma + 1 : gamma + 1;
+            nodes[i].left = left;
+            nodes[i].right = right;
+            nodes[ left ].parent = i;
+            nodes[ right ].parent = i;
+        }
+
+        void update( int node )
+        {
+            LinearNode& a = nodes[ node ];
+            const LinearNode& l = nodes[ a.left ];
+            const LinearNode& r = nodes[ a.right ];
+            a.box = l.box;
+            a.box.extend( r.box );
+            a.numPrims = l.numPrims + r.numPrims;
+            a.cost = BVH_TRAVERSAL_COST * a.box.surfaceArea() + l.cost + r.cost;
+        }
+
+        // Karras and Aila 2013: find the cheapest topology for the up to
+        // seven largest subtrees below root by dynamic programming over
+        // subsets, and rebuild the treelet if it beats the current one
+        void restructure( int root )
+        {
+            const int full = ( 1 << BVH_TREELET_SIZE ) - 1;
+            int leaves[ BVH_TREELET_SIZE ];
+            int interior[ BVH_TREELET_SIZE ];
+            int numLeaves = 2, numInterior = 0;
+            leaves[0] = nodes[ root ].left;
+            leaves[1] = nodes[ root ].right;
+            while( numLeaves < BVH_TREELET_SIZE )
+            {
+                int best = -1;
+                float bestArea = -1;
+                for( int k = 0; k < numLeaves; k++ )
+                {
+                    float area = nodes[ leaves[k] ].box.surfaceArea();
+                    if( !isLeaf( leaves[k] ) && area > bestArea )
+                    {
+                        best = k;
+                        bestArea = area;
+                    }
+                }
+                if( best < 0 )
+                {
+                    break;
+                }
+                int expanded = leaves[ best ];
+                interior[ numInterior++ ] = expanded;
+                leaves[ best ] = nodes[ expanded ].left;
+                leaves[ numLeaves++ ] = nodes[ expanded ].right;
+            }
+            if( numLeaves < 3 )
+            {
+                return;
+            }
+
+            Box boxes[ full + 1 ];
+            float cost[ full + 1 ];
+            int split[ full + 1 ];
+            int all = ( 1 << numLeaves ) - 1;
+            for( int s = 1; s <= all; s++ )
+            {
+                int low = __builtin_ctz( s );
+                if( s == ( 1 << low ) )
+                {
+                    boxes[s] = nodes[ leaves[ low ] ].box;
+                    cost[s] = nodes[ leaves[ low ] ].cost;
+                    continue;
+                }
+                boxes[s] = boxes[ s & ( s - 1 ) ];
+                boxes[s].extend( boxes[ 1 << low ] );
+                // every partition once: the part holding the lowest leaf
+                float best = FLT_MAX;
+                int rest = s & ~( 1 << low );
+                for( int q = ( rest - 1 ) & rest; ; q = ( q - 1 ) & rest )
+                {
+                    int p = q | ( 1 << low );
+                    float c = cost[p] + cost[ s ^ p ];
+                    if( p != s && c < best )
+                    {
+                        best = c;
+                        split[s] = p;
+                    }
+                    if( q == 0 )
+                    {
+                        break;
+                    }
+                }
+                cost[s] = BVH_TRAVERSAL_COST * boxes[s].surfaceArea() + best;
+            }
+            if( cost[ all ] >= nodes[ root ].cost * 0.999f )
+            {
+                return;
+            }
+            assign( all, root, leaves, interior, numInterior, split );
+        }
+
+        int assign( int s, int node, const int* leaves, const int* interior,
+                    int& numInterior, const int* split )
+        {
+            int parts[2] = { split[s], s ^ split[s] };
+            int children[2];
+            for( int k = 0; k < 2; k++ )
+            {
+                if( ( parts[k] & ( parts[k] - 1 ) ) == 0 )
+                {
+                    children[k] = leaves[ __builtin_ctz( parts[k] ) ];
+                }
+                else
+                {
+                    children[k] = assign( parts[k], interior[ --numInterior ],
+                                          leaves, interior, numInterior, split );
+                }
+                nodes[ children[k] ].parent = node;
+            }
+            nodes[ node ].left = children[0];
+            nodes[ node ].right = children[1];
+            update( node );
+            return node;
+        }
+    };
+}
+
+bool BVH::buildLinear( const std::vector< BuildPrim >& prims, bool treelets,
+                       int maxLeafSize, std::vector< BuildNode >& out )
+{
+    int n = ( int )prims.size();
+    ThreadPool& pool = ThreadPool::global();
+
+    // quantized centroids interleaved into Morton codes
+    Box centroidBox;
+    for( int i = 0; i < n; i++ )
+    {
+        centroidBox.extend( prims[i].centroid );
+    }
+    int bits = n <= BVH_MORTON_30_MAX ? 10 : 21;
+    float scale[3];
+    for( int k = 0; k < 3; k++ )
+    {
+        float extent = centroidBox.hi[k] - centroidBox.lo[k];
+        scale[k] = extent > 0 ? ( ( 1 << bits ) - 1 ) / extent : 0;
+    }
+    std::vector< uint64_t > keys( n );
+    std::vector< int > order( n );
+    pool.parallelFor( n, BVH_BIN_CHUNK, [&]( int i ) {
+        uint64_t code = 0;
+        for( int k = 0; k < 3; k++ )
+        {
+            uint64_t q = ( uint64_t )( ( prims[i].centroid[k] - centroidBox.lo[k] ) * scale[k] );
+            code |= spreadBits( q ) << ( 2 - k );
+        }
+        keys[i] = code;
+        order[i] = i;
+    } );
+
+    // LSD radix sort, 8 bits per pass
+    std::vector< uint64_t > keysTmp( n );
+    std::vector< int > orderTmp( n );
+    for( int shift = 0; shift < 3 * bits; shift += 8 )
+    {
+        int count[257] = { 0 };
+        for( int i = 0; i < n; i++ )
+        {
+            count[ ( ( keys[i] >> shift ) & 0xff ) + 1 ]++;
+        }
+        for( int b = 0; b < 256; b++ )
+        {
+            count[ b + 1 ] += count[b];
+        }
+        for( int i = 0; i < n; i++ )
+        {
+            int dst = count[ ( keys[i] >> shift ) & 0xff ]++;
+            keysTmp[ dst ] = keys[i];
+            orderTmp[ dst ] = order[i];
+        }
+        keys.swap( keysTmp );
+        order.swap( orderTmp );
+    }
+
+    LinearTree tree;
+    tree.n = n;
+    tree.codes.swap( keys );
+    tree.nodes.resize( 2 * n - 1 );
+    for( int j = 0; j < n; j++ )
+    {
+        LinearNode& leaf = tree.nodes[ n - 1 + j ];
+        leaf.box = prims[ order[j] ].box;
+        leaf.cost = leaf.box.surfaceArea();
+        leaf.numPrims = 1;
+        leaf.left = leaf.right = -1;
+    }
+    tree.nodes[0].parent = -1;
+    pool.parallelFor( n - 1, BVH_BIN_CHUNK, [&]( int i ) {
+        tree.buildInterior( i );
+    } );
+
+    // bottom up from every leaf; the second child to arrive at a node
+    // finishes it, so both subtrees are final when it is restructured
+    if( n > 1 )
+    {
+        std::unique_ptr< std::atomic< int >[] > arrived( new std::atomic< int >[ n - 1 ] );
+        for( int i = 0; i < n - 1; i++ )
+        {
+            arrived[i].store( 0, std::memory_order_relaxed );
+        }
+        pool.parallelFor( n, BVH_BIN_CHUNK, [&]( int j ) {
+            int node = tree.nodes[ n - 1 + j ].parent;
+            while( node >= 0 && arrived[ node ].fetch_add( 1, std::memory_order_acq_rel ) == 1 )
+            {
+                tree.update( node );
+                if( treelets && tree.nodes[ node ].numPrims >= BVH_TREELET_MIN_PRIMS )
+                {
+                    tree.restructure( node );
+                }
+                node = tree.nodes[ node ].parent;
+            }
+        } );
+    }
+
+    // flatten depth first, the left child right after its parent. A
+    // subtree that fits one leaf block becomes one leaf, as SAH builds
+    // would make it, instead of a leaf per primitive each padded to a block
+    int leafSize = std::max( std::min( leafBlockSize, maxLeafSize ), 1 );
+    struct Entry
+    {
+        int node;
+        int parent; // flattened parent whose second child this is, or -1
+        int depth;
+    };
+    out.reserve( 2 * n - 1 );
+    primIndices.reserve( n );
+    std::vector< Entry > stack;
+    std::vector< int > subtree;
+    stack.push_back( Entry{ 0, -1, 0 } );
+    while( !stack.empty() )
+    {
+        Entry e = stack.back();
+        stack.pop_back();
+        if( e.depth >= MAX_DEPTH )
+        {
+            return false;
+        }
+        int index = ( int )out.size();
+        if( e.parent >= 0 )
+        {
+            out[ e.parent ].offset = index;
+        }
+        const LinearNode& ln = tree.nodes[ e.node ];
+        BuildNode node;
+        node.box = ln.box;
+        if( ln.numPrims <= leafSize )
+        {
+            node.offset = ( int )primIndices.size();
+            node.count = ln.numPrims;
+            subtree.assign( 1, e.node );
+            while( !subtree.empty() )
+            {
+                int s = subtree.back();
+                subtree.pop_back();
+                if( tree.isLeaf( s ) )
+                {
+                    primIndices.push_back( prims[ order[ s - ( n - 1 ) ] ].index );
+                    continue;
+                }
+                subtree.push_back( tree.nodes[s].right );
+                subtree.push_back( tree.nodes[s].left );
+            }
+            out.push_back( node );
+            continue;
+        }
+        node.count = 0;
+        out.push_back( node );
+        stack.push_back( Entry{ ln.right, index, e.depth + 1 } );
+        stack.push_back( Entry{ ln.left, -1, e.depth + 1 } );
+    }
+    return true;
+}
+
+namespace
+{
+    struct SpatialBin
+    {
+        Box box;
+        int entries = 0; // references whose box starts in this bin
+        int exits = 0;   // and ends in it
+    };
+
+    bool isEmpty( const Box& b )
+    {
+        return b.lo[0] > b.hi[0] || b.lo[1] > b.hi[1] || b.lo[2] > b.hi[2];
+    }
+
+    // bounds of the part of triangle tri, nine floats, between the planes
+    // p[axis] = a and p[axis] = b, intersected with refBox. Falls back to
+    // refBox cut to the slab if rounding leaves nothing.
+    Box clipTriangle( const float* tri, const Box& refBox, int axis, float a, float b )
+    {
+        Box clipped;
+        float planes[2] = { a, b };
+        for( int i = 0; i < 3; i++ )
+        {
+            const float* p = tri + 3 * i;
+            const float* q = tri + 3 * ( ( i + 1 ) % 3 );
+            if( p[ axis ] >= a && p[ axis ] <= b )
+            {
+                clipped.extend( p );
+            }
+            for( int j = 0; j < 2; j++ )
+            {
+                if( ( p[ axis ] < planes[j] ) == ( q[ axis ] < planes[j] ) )
+                {
+                    continue;
+                }
+                // the edge crosses the plane
+                float t = ( planes[j] - p[ axis ] ) / ( q[ axis ] - p[ axis ] );
+                float x[3];
+                for( int k = 0; k < 3; k++ )
+                {
+                    x[k] = p[k] + t * ( q[k] - p[k] );
+                }
+                x[ axis ] = planes[j];
+                clipped.extend( x );
+            }
+        }
+        for( int k = 0; k < 3; k++ )
+        {
+            clipped.lo[k] = std::max( clipped.lo[k], refBox.lo[k] );
+            clipped.hi[k] = std::min( clipped.hi[k], refBox.hi[k] );
+        }
+        if( isEmpty( clipped ) )
+        {
+            clipped = refBox;
+            clipped.lo[ axis ] = std::max( clipped.lo[ axis ], a );
+            clipped.hi[ axis ] = std::min( clipped.hi[ axis ], b );
+        }
+        return clipped;
+    }
+}
+
+void BVH::buildSpatial( std::vector< BuildPrim >& prims, const std::vector< Vector3f >& triangles,
+                        int maxLeafSize, std::vector< BuildNode >& out )
+{
+    int n = ( int )prims.size();
+    std::vector< float > corners( 9 * n );
+    for( int i = 0; i < 3 * n; i++ )
+    {
+        for( int k = 0; k < 3; k++ )
+        {
+            corners[ 3 * i + k ] = triangles[i][k];
+        }
+    }
+    Box root;
+    for( int i = 0; i < n; i++ )
+    {
+        root.extend( prims[i].box );
+    }
+    int duplicatesLeft = ( int )( n * BVH_SPATIAL_BUDGET );
+    out.reserve( 2 * n );
+    primIndices.reserve( n + duplicatesLeft );
+    std::vector< BuildPrim > refs;
+    refs.swap( prims );
+    buildSpatialNode( refs, corners.data(), 0, maxLeafSize, root.surfaceArea(), duplicatesLeft, out );
+}
+
+void BVH::buildSpatialNode( std::vector< BuildPrim >& refs, const float* corners, int depth,
+                            int maxLeafSize, float rootArea, int& duplicatesLeft,
+                            std::vector< BuildNode >& out )
+{
+    int nodeIndex = ( int )out.size();
+    out.push_back( BuildNode() );
+    int n = ( int )refs.size();
+
+    Box box, centroidBox;
+    for( int i = 0; i < n; i++ )
+    {
+        box.extend( refs[i].box );
+        centroidBox.extend( refs[i].centroid );
+    }
+    out[ nodeIndex ].box = box;
+
+    bool median = depth >= BVH_SAH_DEPTH;
+    bool makeLeaf = n == 1 || ( n <= maxLeafSize && median );
+    float invArea = 1.0f / std::max( box.surfaceArea(), FLT_MIN );
+    float lo[3], extent[3];
+    for( int k = 0; k < 3; k++ )
+    {
+        lo[k] = centroidBox.lo[k];
+        extent[k] = centroidBox.hi[k] - lo[k];
+    }
+
+    // object split, binned over the centroids as in buildNode
+    float bestCost = FLT_MAX;
+    int objectAxis = extent[0] > extent[1] && extent[0] > extent[2] ? 0 : ( extent[1] > extent[2] ? 1 : 2 );
+    int objectBin = -1;
+    Box objectLeft, objectRight;
+    for( int axis = 0; axis < 3 && !makeLeaf && !median; axis++ )
+    {
+        if( extent[ axis ] <= 0 )
+        {
+            continue;
+        }
+        float scale = BVH_NUM_BINS / extent[ axis ];
+        Bin bins[ BVH_NUM_BINS ];
+        for( int i = 0; i < n; i++ )
+        {
+            Bin& bin = bins[ binIndex( refs[i].centroid[ axis ], lo[ axis ], scale ) ];
+            bin.box.extend( refs[i].box );
+            bin.count++;
+        }
+        Box right[ BVH_NUM_BINS ];
+        int rightCount[ BVH_NUM_BINS ];
+        int count = 0;
+        for( int b = BVH_NUM_BINS - 1; b > 0; b-- )
+        {
+            right[b] = b + 1 < BVH_NUM_BINS ? right[ b + 1 ] : Box();
+            if( bins[b].count > 0 )
+            {
+                right[b].extend( bins[b].box );
+            }
+            count += bins[b].count;
+            rightCount[b] = count;
+        }
+        Box left;
+        count = 0;
+        for( int b = 0; b < BVH_NUM_BINS - 1; b++ )
+        {
+            if( bins[b].count == 0 )
+            {
+                continue;
+            }
+            left.extend( bins[b].box );
+            count += bins[b].count;
+            if( rightCount[ b + 1 ] == 0 )
+            {
+                continue;
+            }
+            float cost = BVH_TRAVERSAL_COST + ( left.surfaceArea() * count +
+                right[ b + 1 ].surfaceArea() * rightCount[ b + 1 ] ) * invArea;
+            if( cost < bestCost )
+            {
+                bestCost = cost;
+                objectAxis = axis;
+                objectBin = b;
+                objectLeft = left;
+                objectRight = right[ b + 1 ];
+            }
+        }
+    }
+
+    // spatial split: bin the references by where their boxes lie, clipping
+    // each triangle to every bin it spans. Only worth it where the object
+    // split children overlap.
+    int spatialAxis = -1;
+    float spatialPos = 0;
+    Box spatialLeft, spatialRight;
+    int spatialLeftCount = 0, spatialRightCount = 0;
+    Box overlap;
+    for( int k = 0; k < 3; k++ )
+    {
+        overlap.lo[k] = std::max( objectLeft.lo[k], objectRight.lo[k] );
+        overlap.hi[k] = std::min( objectLeft.hi[k], objectRight.hi[k] );
+    }
+    bool trySpatial = objectBin < 0 || ( !isEmpty( overlap ) && overlap.surfaceArea() > BVH_SPATIAL_ALPHA * rootArea );
+    for( int axis = 0; axis < 3 && trySpatial && !makeLeaf && !median && duplicatesLeft > 0; axis++ )
+    {
+        float width = ( box.hi[ axis ] - box.lo[ axis ] ) / BVH_NUM_BINS;
+        if( width <= 0 )
+        {
+            continue;
+        }
+        float scale = 1.0f / width;
+        SpatialBin bins[ BVH_NUM_BINS ];
+        for( int i = 0; i < n; i++ )
+        {
+            const BuildPrim& ref = refs[i];
+            int first = binIndex( ref.box.lo[ axis ], box.lo[ axis ], scale );
+            int last = binIndex( ref.box.hi[ axis ], box.lo[ axis ], scale );
+            bins[ first ].entries++;
+            bins[ last ].exits++;
+            if( first == last )
+            {
+                bins[ first ].box.extend( ref.box );
+                continue;
+            }
+            for( int b = first; b <= last; b++ )
+            {
+                float a = b == first ? -FLT_MAX : box.lo[ axis ] + b * width;
+                float c = b == last ? FLT_MAX : box.lo[ axis ] + ( b + 1 ) * width;
+                bins[b].box.extend( clipTriangle( corners + 9 * ref.index, ref.box, axis, a, c ) );
+            }
+        }
+        Box right[ BVH_NUM_BINS ];
+        int rightCount[ BVH_NUM_BINS ];
+        int count = 0;
+        for( int b = BVH_NUM_BINS - 1; b > 0; b-- )
+        {
+            right[b] = b + 1 < BVH_NUM_BINS ? right[ b + 1 ] : Box();
+            right[b].extend( bins[b].box );
+            count += bins[b].exits;
+            rightCount[b] = count;
+        }
+        Box left;
+        count = 0;
+        for( int b = 0; b < BVH_NUM_BINS - 1; b++ )
+        {
+            left.extend( bins[b].box );
+            count += bins[b].entries;
+            if( count == 0 || rightCount[ b + 1 ] == 0 || count + rightCount[ b + 1 ] - n > duplicatesLeft )
+            {
+                continue;
+            }
+            float cost = BVH_TRAVERSAL_COST + ( left.surfaceArea() * count +
+                right[ b + 1 ].surfaceArea() * rightCount[ b + 1 ] ) * invArea;
+            if( cost < bestCost )
+            {
+                bestCost = cost;
+                spatialAxis = axis;
+                spatialPos = box.lo[ axis ] + ( b + 1 ) * width;
+                spatialLeft = left;
+                spatialRight = right[ b + 1 ];
+                spatialLeftCount = count;
+                spatialRightCount = rightCount[ b + 1 ];
+            }
+        }
+    }
+
+    if( !makeLeaf && !median && objectBin < 0 && spatialAxis < 0 )
+    {
+        // all centroids coincide and nothing can be clipped apart
+        makeLeaf = n <= maxLeafSize;
+        median = true;
+    }
+    else if( bestCost >= ( float )( ( n + leafBlockSize - 1 ) / leafBlockSize ) && n <= maxLeafSize )
+    {
+        makeLeaf = true;
+    }
+    if( median && n <= maxLeafSize )
+    {
+        makeLeaf = true;
+    }
+
+    if( makeLeaf )
+    {
+        out[ nodeIndex ].offset = ( int )primIndices.size();
+        out[ nodeIndex ].count = n;
+        for( int i = 0; i < n; i++ )
+        {
+            primIndices.push_back( refs[i].index );
+        }
+        return;
+    }
+
+    std::vector< BuildPrim > left, right;
+    if( spatialAxis >= 0 && !median )
+    {
+        int axis = spatialAxis;
+        float leftArea = spatialLeft.surfaceArea(), rightArea = spatialRight.surfaceArea();
+        for( int i = 0; i < n; i++ )
+        {
+            const BuildPrim& ref = refs[i];
+            if( ref.box.hi[ axis ] <= spatialPos )
+            {
+                left.push_back( ref );
+                continue;
+            }
+            if( ref.box.lo[ axis ] >= spatialPos )
+            {
+                right.push_back( ref );
+                continue;
+            }
+            // reference unsplitting: keep the triangle whole on one side
+            // if that is cheaper than clipping it
+            Box l = spatialLeft, r = spatialRight;
+            l.extend( ref.box );
+            r.extend( ref.box );
+            float splitCost = leftArea * spatialLeftCount + rightArea * spatialRightCount;
+            float leftCost = l.surfaceArea() * spatialLeftCount + rightArea * ( spatialRightCount - 1 );
+            float rightCost = leftArea * ( spatialLeftCount - 1 ) + r.surfaceArea() * spatialRightCount;
+            if( leftCost < splitCost && leftCost <= rightCost )
+            {
+                left.push_back( ref );
+                spatialLeft = l;
+                leftArea = l.surfaceArea();
+                spatialRightCount--;
+            }
+            else if( rightCost < splitCost )
+            {
+                right.push_back( ref );
+                spatialRight = r;
+                rightArea = r.surfaceArea();
+                spatialLeftCount--;
+            }
+            else
+            {
+                const float* tri = corners + 9 * ref.index;
+                BuildPrim lref = ref, rref = ref;
+                lref.box = clipTriangle( tri, ref.box, axis, -FLT_MAX, spatialPos );
+                rref.box = clipTriangle( tri, ref.box, axis, spatialPos, FLT_MAX );
+                for( int k = 0; k < 3; k++ )
+                {
+                    lref.centroid[k] = 0.5f * ( lref.box.lo[k] + lref.box.hi[k] );
+                    rref.centroid[k] = 0.5f * ( rref.box.lo[k] + rref.box.hi[k] );
+                }
+                left.push_back( lref );
+                right.push_back( rref );
+            }
+        }
+        if( left.empty() || right.empty() )
+        {
+            // rounding put everything on one side, split the objects instead
+            left.clear();
+            right.clear();
+        }
+        else
+        {
+            duplicatesLeft = std::max( duplicatesLeft - ( ( int )( left.size() + right.size() ) - n ), 0 );
+        }
+    }
+    if( left.empty() )
+    {
+        int mid;
+        if( median || objectBin < 0 )
+        {
+            mid = n / 2;
+            std::nth_element( refs.begin(), refs.begin() + mid, refs.end(), CentroidLess( objectAxis ) );
+        }
+        else
+        {
+            float axisLo = lo[ objectAxis ];
+            float axisScale = BVH_NUM_BINS / extent[ objectAxis ];
+            mid = ( int )( std::partition( refs.begin(), refs.end(), [&]( const BuildPrim& p ) {
+                return binIndex( p.centroid[ objectAxis ], axisLo, axisScale ) <= objectBin;
+            } ) - refs.begin() );
+        }
+        left.assign( refs.begin(), refs.begin() + mid );
+        right.assign( refs.begin() + mid, refs.end() );
+    }
+    // the children own their references now
+    std::vector< BuildPrim >().swap( refs );
+
+    buildSpatialNode( left, corners, depth + 1, maxLeafSize, rootArea, duplicatesLeft, out );
+    out[ nodeIndex ].offset = ( int )out.size();
+    buildSpatialNode( right, corners, depth + 1, maxLeafSize, rootArea, duplicatesLeft, out );
+    out[ nodeIndex ].count = 0;
+}
+
+void BVH::refit( const std::vector< BBox >& primBounds )
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // children always follow their parent, so one backward pass suffices;
+    // exact boxes are kept aside and every node is quantized again
+    std::vector< Box > exact( nodes.size() );
+    for( int i = ( int )nodes.size() - 1; i >= 0; i-- )
+    {
+        BVHNode& node = nodes[i];
+        Box boxes[ BVH_WIDTH ];
+        for( int c = 0; c < node.numChildren; c++ )
+        {
+            if( node.count[c] > 0 )
+            {
+                for( int k = 0; k < node.count[c]; k++ )
+                {
+                    const BBox& b = primBounds[ primIndices[ node.child[c] + k ] ];
+                    for( int j = 0; j < 3; j++ )
+                    {
+                        boxes[c].lo[j] = std::min( boxes[c].lo[j], b.getMin()[j] );
+                        boxes[c].hi[j] = std::max( boxes[c].hi[j], b.getMax()[j] );
+                    }
+                }
+            }
+            else
+            {
+                boxes[c] = exact[ node.child[c] ];
+            }
+            exact[i].extend( boxes[c] );
+        }
+        quantize( node, boxes, node.numChildren );
+    }
+    if( !nodes.empty() )
+    {
+        computeStats();
+    }
+    stats.buildSeconds = std::chrono::duration< double >(
+        std::chrono::steady_clock::now() - start ).count();
+}
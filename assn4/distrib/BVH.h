@@ -0,0 +1,477 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include "BBox.h"
+#include "Ray.h"
+#include "Hit.h"
+
+// children per node, one SSE lane each
+#define BVH_WIDTH 4
+
+// one node of the 4-wide BVH the traversal runs on, a single cache line.
+// Child boxes are stored in 8 bits per plane relative to the node,
+// lo = origin + qlo * 2^exponent, rounded outward; empty slots hold an
+// inverted box. Nodes are stored depth first.
+struct alignas( 64 ) BVHNode
+{
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t numChildren;
+    uint8_t qlo[3][ BVH_WIDTH ];
+    uint8_t qhi[3][ BVH_WIDTH ];
+    int child[ BVH_WIDTH ];     // interior: node index; leaf: first entry in primIndices
+    uint8_t count[ BVH_WIDTH ]; // primitives in a leaf child, 0 for interior children
+};
+
+// quality and cost of the last build
+struct BVHStats
+{
+    double buildSeconds;
+    float sahCost;     // expected cost of a random ray, relative to one primitive test
+    int maxDepth;
+    int numNodes;      // wide nodes
+    size_t bytes;      // nodes plus primitive indices
+    int numLeaves;
+    int minLeafSize;
+    int maxLeafSize;
+    float avgLeafSize;
+};
+
+///Bounding volume hierarchy over an array of primitive bounds,
+///built with the surface area heuristic as a binary tree and then
+///collapsed into a 4-wide tree with quantized child boxes, which the
+///traversal tests four at a time.
+///Splits are chosen from a fixed number of centroid bins per axis, and
+///large subtrees are built as parallel tasks on ThreadPool::global().
+///For scenes rebuilt every frame a linear BVH over sorted Morton codes
+///builds much faster at some cost in quality, which treelet
+///restructuring wins most of back; refit() only updates the boxes.
+///Triangle meshes can also be built with spatial splits (SBVH), which
+///clip triangles that straddle a split and reference them from both
+///sides; this pays off for long, thin triangles whose boxes overlap.
+///The hierarchy only knows about indices; callers pass a functor that
+///intersects primitive i during traversal.
+class BVH
+{
+public:
+
+    static const int MAX_DEPTH = 64;
+
+    ///build quality versus build speed
+    enum Quality
+    {
+        SAH,          // binned SAH, the best trees
+        LBVH,         // Morton code order, the fastest build
+        LBVH_TREELET, // LBVH with its treelets reordered by SAH
+        SBVH          // SAH with spatial splits, triangles only
+    };
+
+    ///print the stats of every build to stdout
+    inline static bool printStats = false;
+
+    BVH() {}
+
+    ///@param primBounds bounds of every primitive, indexed as the caller's array
+    ///@param maxLeafSize largest leaf of SAH builds; linear builds make
+    ///leaves of up to the leaf block size, capped by it
+    ///@param triangles three corners per primitive, needed by SBVH, which
+    ///falls back to SAH without them. primIndices may then list a primitive
+    ///more than once.
+    void build( const std::vector< BBox >& primBounds, int maxLeafSize = 4,
+                Quality quality = SAH, const std::vector< Vector3f >* triangles = NULL );
+
+    ///recomputes the node boxes for moved primitives, keeping the tree;
+    ///cheap, but the tree degrades as the primitives move further.
+    ///Leaves made by spatial splits get the unclipped bounds.
+    void refit( const std::vector< BBox >& primBounds );
+
+    bool empty() const
+    {
+        return nodes.empty();
+    }
+
+    ///for callers that test primitives in blocks, such as four at a time
+    ///with SSE: SAH builds then cost a leaf per block rather than per
+    ///primitive, linear builds merge subtrees that fit one block into a
+    ///leaf, and alignLeaves() pads to this size
+    void setLeafBlockSize( int size )
+    {
+        leafBlockSize = size;
+    }
+
+    ///moves every leaf to a multiple of the leaf block size in primIndices,
+    ///filling each leaf up with its last primitive, so callers can store
+    ///the primitives of a leaf in fixed size blocks. Leaf counts are
+    ///unchanged.
+    void alignLeaves();
+
+    ///bounds of the root, rounded outward
+    BBox getBounds() const;
+
+    ///stats of the last build() or refit(), all zero for trees filled in elsewhere
+    const BVHStats& getStats() const
+    {
+        return stats;
+    }
+
+    ///closest hit traversal, h.getT() is the current closest distance
+    ///@param intersectPrim bool(int i), true if primitive i updated h
+    template< class PrimTest >
+    bool intersect( const Ray& r, Hit& h, float tmin, PrimTest intersectPrim ) const
+    {
+        return intersectLeaves( r, h, tmin, [&]( int first, int count ) {
+            bool result = false;
+            for( int i = 0; i < count; ++i )
+            {
+                result |= intersectPrim( primIndices[ first + i ] );
+            }
+            return result;
+        } );
+    }
+
+    ///closest hit traversal handing whole leaves to the caller, for
+    ///callers that test several primitives at once.
+    ///Children are visited near to far; the leaves of a node are tested
+    ///before its interior children are pushed.
+    ///@param intersectLeaf bool(int first, int count), tests the primitives
+    ///primIndices[first, first + count), true if one of them updated h
+    template< class LeafTest >
+    bool intersectLeaves( const Ray& r, Hit& h, float tmin, LeafTest intersectLeaf ) const
+    {
+        if( nodes.empty() )
+        {
+            return false;
+        }
+        TraversalRay ray( r );
+        StackEntry stack[ STACK_SIZE ];
+        int stackSize = 0;
+        stack[ stackSize++ ] = StackEntry{ 0, tmin };
+        bool result = false;
+        while( stackSize > 0 )
+        {
+            StackEntry entry = stack[ --stackSize ];
+            if( entry.tNear > h.getT() )
+            {
+                continue;
+            }
+            const BVHNode& node = nodes[ entry.node ];
+            float tNear[ BVH_WIDTH ];
+            int mask = intersectChildren( node, ray, tmin, h.getT(), tNear );
+            if( !mask )
+            {
+                continue;
+            }
+            int order[ BVH_WIDTH ];
+            int hits = sortChildren( mask, tNear, order );
+            for( int k = 0; k < hits; k++ )
+            {
+                int c = order[k];
+                if( node.count[c] > 0 )
+                {
+                    result |= intersectLeaf( node.child[c], node.count[c] );
+                }
+            }
+            for( int k = hits - 1; k >= 0; k-- )
+            {
+                int c = order[k];
+                if( node.count[c] == 0 )
+                {
+                    stack[ stackSize++ ] = StackEntry{ node.child[c], tNear[c] };
+                }
+            }
+        }
+        return result;
+    }
+
+    ///any hit traversal, stops at the first primitive that blocks the ray
+    ///@param occludedPrim bool(int i), true if primitive i blocks [tmin, tmax)
+    template< class PrimTest >
+    bool occluded( const Ray& r, float tmin, float tmax, PrimTest occludedPrim ) const
+    {
+        return occludedLeaves( r, tmin, tmax, [&]( int first, int count ) {
+            for( int i = 0; i < count; ++i )
+            {
+                if( occludedPrim( primIndices[ first + i ] ) )
+                {
+                    return true;
+                }
+            }
+            return false;
+        } );
+    }
+
+    ///any hit traversal handing whole leaves to the caller
+    ///@param occludedLeaf bool(int first, int count), true if one of the
+    ///primitives primIndices[first, first + count) blocks [tmin, tmax)
+    template< class LeafTest >
+    bool occludedLeaves( const Ray& r, float tmin, float tmax, LeafTest occludedLeaf ) const
+    {
+        if( nodes.empty() )
+        {
+            return false;
+        }
+        TraversalRay ray( r );
+        int stack[ STACK_SIZE ];
+        int stackSize = 0;
+        stack[ stackSize++ ] = 0;
+        while( stackSize > 0 )
+        {
+            const BVHNode& node = nodes[ stack[ --stackSize ] ];
+            float tNear[ BVH_WIDTH ];
+            int mask = intersectChildren( node, ray, tmin, tmax, tNear );
+            // any order will do, no need to sort the children
+            for( int c = 0; c < BVH_WIDTH; c++ )
+            {
+                if( !( mask & ( 1 << c ) ) )
+                {
+                    continue;
+                }
+                if( node.count[c] == 0 )
+                {
+                    stack[ stackSize++ ] = node.child[c];
+                    continue;
+                }
+                if( occludedLeaf( node.child[c], node.count[c] ) )
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+#ifdef RT_USE_SSE
+    ///closest hit traversal for a packet. A child is entered if any ray
+    ///overlaps it; children are visited in the order the packet enters them.
+    ///@param intersectPrim int(int i), mask of rays primitive i hit
+    template< class PrimTest >
+    int intersectPacket( const RayPacket& p, HitPacket& h, float tmin, PrimTest intersectPrim ) const
+    {
+        if( nodes.empty() )
+        {
+            return 0;
+        }
+        __m128 tmin4 = _mm_set1_ps( tmin );
+        __m128 tmax4 = h.getT();
+        int stack[ STACK_SIZE ];
+        int stackSize = 0;
+        stack[ stackSize++ ] = 0;
+        int result = 0;
+        while( stackSize > 0 )
+        {
+            const BVHNode& node = nodes[ stack[ --stackSize ] ];
+            float tNear[ BVH_WIDTH ];
+            int mask = 0;
+            for( int c = 0; c < node.numChildren; c++ )
+            {
+                if( intersectChild( node, c, p, tmin4, tmax4, tNear[c] ) )
+                {
+                    mask |= 1 << c;
+                }
+            }
+            int order[ BVH_WIDTH ];
+            int hits = sortChildren( mask, tNear, order );
+            for( int k = 0; k < hits; k++ )
+            {
+                int c = order[k];
+                int hitMask = 0;
+                for( int i = 0; i < node.count[c]; ++i )
+                {
+                    hitMask |= intersectPrim( primIndices[ node.child[c] + i ] );
+                }
+                if( hitMask )
+                {
+                    result |= hitMask;
+                    tmax4 = h.getT();
+                }
+            }
+            for( int k = hits - 1; k >= 0; k-- )
+            {
+                int c = order[k];
+                if( node.count[c] == 0 )
+                {
+                    stack[ stackSize++ ] = node.child[c];
+                }
+            }
+        }
+        return result;
+    }
+#endif
+
+    std::vector< BVHNode > nodes;
+    std::vector< int > primIndices;
+
+private:
+
+    // at most three pending children per level
+    static const int STACK_SIZE = ( BVH_WIDTH - 1 ) * MAX_DEPTH + 1;
+
+    struct BuildPrim;
+    struct BuildNode;
+
+    struct StackEntry
+    {
+        int node;
+        float tNear;
+    };
+
+    // the ray's origin in plain floats next to what the ray precomputed
+    struct TraversalRay
+    {
+        float o[3];
+        float invD[3];
+        int neg[3];
+
+        TraversalRay( const Ray& r )
+        {
+            for( int k = 0; k < 3; k++ )
+            {
+                o[k] = r.getOrigin()[k];
+                invD[k] = r.getInvDirection()[k];
+                neg[k] = r.getSign( k );
+            }
+        }
+    };
+
+    static float exponentScale( int8_t exponent )
+    {
+        int bits = ( exponent + 127 ) << 23;
+        float scale;
+        memcpy( &scale, &bits, sizeof( scale ) );
+        return scale;
+    }
+
+    ///slab test of all children of a node
+    ///@return bit c is set if the ray overlaps child c, entering at tNear[c]
+    static int intersectChildren( const BVHNode& node, const TraversalRay& r,
+                                  float tmin, float tmax, float* tNear )
+    {
+#ifdef RT_USE_SSE
+        __m128 t0 = _mm_set1_ps( tmin );
+        __m128 t1 = _mm_set1_ps( tmax );
+        __m128i zero = _mm_setzero_si128();
+        for( int k = 0; k < 3; k++ )
+        {
+            __m128 scale = _mm_set1_ps( exponentScale( node.exponent[k] ) );
+            __m128 origin = _mm_set1_ps( node.origin[k] );
+            int32_t lo, hi;
+            memcpy( &lo, node.qlo[k], 4 );
+            memcpy( &hi, node.qhi[k], 4 );
+            __m128i qlo = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( lo ), zero ), zero );
+            __m128i qhi = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( hi ), zero ), zero );
+            __m128 planeLo = _mm_add_ps( origin, _mm_mul_ps( _mm_cvtepi32_ps( qlo ), scale ) );
+            __m128 planeHi = _mm_add_ps( origin, _mm_mul_ps( _mm_cvtepi32_ps( qhi ), scale ) );
+            __m128 o = _mm_set1_ps( r.o[k] );
+            __m128 invD = _mm_set1_ps( r.invD[k] );
+            __m128 tLo = _mm_mul_ps( _mm_sub_ps( planeLo, o ), invD );
+            __m128 tHi = _mm_mul_ps( _mm_sub_ps( planeHi, o ), invD );
+            // picking planes by sign keeps inverted (empty) boxes missing
+            // NaN from 0 * inf leaves t0 and t1 alone: maxps and minps
+            // return their second operand then
+            t0 = _mm_max_ps( r.neg[k] ? tHi : tLo, t0 );
+            t1 = _mm_min_ps( r.neg[k] ? tLo : tHi, t1 );
+        }
+        _mm_storeu_ps( tNear, t0 );
+        return _mm_movemask_ps( _mm_cmple_ps( t0, t1 ) ) & ( ( 1 << node.numChildren ) - 1 );
+#else
+        int mask = 0;
+        for( int c = 0; c < node.numChildren; c++ )
+        {
+            float t0 = tmin, t1 = tmax;
+            for( int k = 0; k < 3; k++ )
+            {
+                float scale = exponentScale( node.exponent[k] );
+                float tLo = ( node.origin[k] + node.qlo[k][c] * scale - r.o[k] ) * r.invD[k];
+                float tHi = ( node.origin[k] + node.qhi[k][c] * scale - r.o[k] ) * r.invD[k];
+                t0 = std::max( t0, r.neg[k] ? tHi : tLo );
+                t1 = std::min( t1, r.neg[k] ? tLo : tHi );
+            }
+            tNear[c] = t0;
+            if( t0 <= t1 )
+            {
+                mask |= 1 << c;
+            }
+        }
+        return mask;
+#endif
+    }
+
+#ifdef RT_USE_SSE
+    ///slab test of one child against all rays of a packet
+    ///@return mask of the rays that overlap it, tNear is the earliest entry
+    static int intersectChild( const BVHNode& node, int c, const RayPacket& p,
+                               __m128 tmin, __m128 tmax, float& tNear )
+    {
+        for( int k = 0; k < 3; k++ )
+        {
+            float scale = exponentScale( node.exponent[k] );
+            __m128 planeLo = _mm_set1_ps( node.origin[k] + node.qlo[k][c] * scale );
+            __m128 planeHi = _mm_set1_ps( node.origin[k] + node.qhi[k][c] * scale );
+            __m128 tLo = _mm_mul_ps( _mm_sub_ps( planeLo, p.o[k] ), p.invD[k] );
+            __m128 tHi = _mm_mul_ps( _mm_sub_ps( planeHi, p.o[k] ), p.invD[k] );
+            tmin = _mm_max_ps( tmin, _mm_min_ps( tLo, tHi ) );
+            tmax = _mm_min_ps( tmax, _mm_max_ps( tLo, tHi ) );
+        }
+        int mask = _mm_movemask_ps( _mm_cmple_ps( tmin, tmax ) );
+        float t[4];
+        _mm_storeu_ps( t, tmin );
+        tNear = FLT_MAX;
+        for( int i = 0; i < PACKET_SIZE; i++ )
+        {
+            if( ( mask & ( 1 << i ) ) && t[i] < tNear )
+            {
+                tNear = t[i];
+            }
+        }
+        return mask;
+    }
+#endif
+
+    ///the children set in mask, nearest first
+    ///@return number of children written to order
+    static int sortChildren( int mask, const float* tNear, int* order )
+    {
+        int hits = 0;
+        for( int c = 0; c < BVH_WIDTH; c++ )
+        {
+            if( !( mask & ( 1 << c ) ) )
+            {
+                continue;
+            }
+            int k = hits++;
+            while( k > 0 && tNear[ order[ k - 1 ] ] > tNear[c] )
+            {
+                order[k] = order[ k - 1 ];
+                k--;
+            }
+            order[k] = c;
+        }
+        return hits;
+    }
+
+    // builds the subtree over prims [begin, end) and appends it depth
+    // first to out; leaves point straight into prims
+    void buildNode( std::vector< BuildPrim >& prims, int begin, int end,
+                    int depth, int maxLeafSize, std::vector< BuildNode >& out );
+    // false if the tree would be too deep to traverse
+    bool buildLinear( const std::vector< BuildPrim >& prims, bool treelets, int maxLeafSize,
+                      std::vector< BuildNode >& out );
+    // spatial split build, writes primIndices as it makes leaves
+    void buildSpatial( std::vector< BuildPrim >& prims, const std::vector< Vector3f >& triangles,
+                       int maxLeafSize, std::vector< BuildNode >& out );
+    // refs are handed down to the children; corners holds 9 floats per primitive
+    void buildSpatialNode( std::vector< BuildPrim >& refs, const float* corners, int depth,
+                           int maxLeafSize, float rootArea, int& duplicatesLeft,
+                           std::vector< BuildNode >& out );
+    // appends the wide node standing for binary node b and its subtree
+    int collapse( const std::vector< BuildNode >& binary, int b );
+    void computeStats();
+
+    BVHStats stats = BVHStats();
+    int leafBlockSize = 1;
+};
+
+#endif // BVH_H
@@ -5,29 +5,52 @@
 #include "Object3D.h"
 #include "Ray.h"
 #include "Hit.h"
+#include "BVH.h"
+#include "PrimitiveSet.h"
 #include <iostream>
 #include <cassert>
+#include <cmath>
+#include <vector>
 
 using  namespace std;
 
-///TODO: 
-///Implement Group
-///Add data structure to store a list of Object* 
+///Group stores a list of Object3D*.
+///It does not own its children: scenes are built in the SceneParser's
+///arena, which frees every object at once.
+///After all objects are added, buildBVH() builds a SAH bounding volume
+///hierarchy over the bounded children; unbounded ones (planes) are
+///tested linearly on every ray.
+///The children are copied into PrimitiveSets in BVH leaf order, so
+///traversal reads spheres and triangles from flat arrays instead of
+///calling them virtually.
+///Every hit of a child pushes the child's index on the hit, which
+///getAttributes() pops to find it again: entry i of bounded as i, entry
+///i of unbounded as ~i, or objects[i] as i without the BVH.
+///findOccluder() pushes the same indices on the occluder it records.
 class Group :public Object3D
 {
 public:
-
+	///set to false to test every child linearly, for comparison
+	inline static bool useBVH = true;
 
 	Group() {
 		capacity = 4;
 		size = 0;
 		objects = new Object3D * [capacity];
+		for (int i = 0; i < capacity; i++)
+		{
+			objects[i] = NULL;
+		}
 	}
 
 	Group(int num_objects) {
 		capacity = num_objects;
 		size = 0;
 		objects = new Object3D * [capacity];
+		for (int i = 0; i < capacity; i++)
+		{
+			objects[i] = NULL;
+		}
 	}
 
 	~Group() {
@@ -37,11 +60,274 @@ public:
 	}
 
 	virtual bool intersect(const Ray& r, Hit& h, float tmin) {
+		if (!useBVH || !hasBVH)
+		{
+			return intersectLinear(r, h, tmin);
+		}
+
+		bool result = bvh.intersect(r, h, tmin, [&](int i) {
+			if (!bounded.intersect(i, r, h, tmin))
+			{
+				return false;
+			}
+			h.push(i);
+			return true;
+		});
+		for (int i = 0; i < unbounded.size(); i++)
+		{
+			if (unbounded.intersect(i, r, h, tmin))
+			{
+				h.push(~i);
+				result = true;
+			}
+		}
+		return result;
+	}
+
+	virtual void getAttributes(const Ray& r, Hit& h) {
+		int i;
+		if (!h.pop(i))
+		{
+			i = findChild(r, h);
+		}
+		if (!useBVH || !hasBVH)
+		{
+			objects[i]->getAttributes(r, h);
+		}
+		else if (i >= 0)
+		{
+			bounded.getAttributes(i, r, h);
+		}
+		else
+		{
+			unbounded.getAttributes(~i, r, h);
+		}
+	}
+
+#ifdef RT_USE_SSE
+	///packets whose rays point into different octants have no common
+	///front-to-back order and fall back to single rays
+	virtual int intersectPacket(const RayPacket& p, HitPacket& h, float tmin) {
+		if (!useBVH || !hasBVH || !p.isCoherent())
+		{
+			return Object3D::intersectPacket(p, h, tmin);
+		}
+
+		int result = bvh.intersectPacket(p, h, tmin, [&](int i) {
+			int mask = bounded.intersectPacket(i, p, h, tmin);
+			pushPacket(h, mask, i);
+			return mask;
+		});
+		for (int i = 0; i < unbounded.size(); i++)
+		{
+			int mask = unbounded.intersectPacket(i, p, h, tmin);
+			pushPacket(h, mask, ~i);
+			result |= mask;
+		}
+		return result;
+	}
+#endif
+
+	virtual bool occluded(const Ray& r, float tmin, float tmax) {
+		if (!useBVH || !hasBVH)
+		{
+			for (int i = 0; i < size; i++)
+			{
+				if (objects[i]->occluded(r, tmin, tmax))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		for (int i = 0; i < unbounded.size(); i++)
+		{
+			if (unbounded.occluded(i, r, tmin, tmax))
+			{
+				return true;
+			}
+		}
+		return bvh.occluded(r, tmin, tmax, [&](int i) {
+			return bounded.occluded(i, r, tmin, tmax);
+		});
+	}
+
+	virtual bool findOccluder(const Ray& r, float tmin, float tmax, Occluder& o) {
+		if (!useBVH || !hasBVH)
+		{
+			for (int i = 0; i < size; i++)
+			{
+				if (objects[i]->findOccluder(r, tmin, tmax, o))
+				{
+					o.push(i);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		for (int i = 0; i < unbounded.size(); i++)
+		{
+			if (unbounded.findOccluder(i, r, tmin, tmax, o))
+			{
+				o.push(~i);
+				return true;
+			}
+		}
+		return bvh.occluded(r, tmin, tmax, [&](int i) {
+			if (!bounded.findOccluder(i, r, tmin, tmax, o))
+			{
+				return false;
+			}
+			o.push(i);
+			return true;
+		});
+	}
+
+	virtual bool occludedBy(const Ray& r, float tmin, float tmax, const Occluder& o, int level) {
+		if (level <= 0)
+		{
+			return occluded(r, tmin, tmax);
+		}
+		int i = o.getChild(level);
+		if (!useBVH || !hasBVH)
+		{
+			return objects[i]->occludedBy(r, tmin, tmax, o, level - 1);
+		}
+		if (i >= 0)
+		{
+			return bounded.occludedBy(i, r, tmin, tmax, o, level - 1);
+		}
+		return unbounded.occludedBy(~i, r, tmin, tmax, o, level - 1);
+	}
+
+	///the index intersect() would have pushed for the child holding the
+	///hit, found by intersecting the children again around its t; only
+	///needed when groups nest deeper than HIT_MAX_DEPTH and the path lost it
+	int findChild(const Ray& r, const Hit& h) {
+		float t = h.getT();
+		float slack = 1e-4f * fabs(t) + 1e-6f;
+		HitPath scratch;
+		Hit probe(t + slack, NULL, Vector3f(0, 0, 0));
+		probe.setPath(&scratch);
+		// the closest child wins, as in intersect(); if rounding hides
+		// the hit the first child is used
+		int found = 0;
+		if (!useBVH || !hasBVH)
+		{
+			for (int i = 0; i < size; i++)
+			{
+				if (objects[i]->intersect(r, probe, t - slack))
+				{
+					found = i;
+				}
+			}
+			return found;
+		}
+		found = bounded.size() > 0 ? 0 : ~0;
+		for (int i = 0; i < bounded.size(); i++)
+		{
+			if (bounded.intersect(i, r, probe, t - slack))
+			{
+				found = i;
+			}
+		}
+		for (int i = 0; i < unbounded.size(); i++)
+		{
+			if (unbounded.intersect(i, r, probe, t - slack))
+			{
+				found = ~i;
+			}
+		}
+		return found;
+	}
+
+	bool intersectLinear(const Ray& r, Hit& h, float tmin) {
+		bool result = false;
+		for (int i = 0; i < size; i++)
+		{
+			if (objects[i]->intersect(r, h, tmin))
+			{
+				h.push(i);
+				result = true;
+			}
+		}
+
+		return result;
+	}
+
+	///builds the hierarchy over the current children,
+	///call again after adding objects
+	void buildBVH(BVH::Quality quality = BVH::SAH) {
+		bounded.clear();
+		unbounded.clear();
+		bounds = BBox();
+		std::vector<Object3D*> boundedObjects;
+		std::vector<BBox> primBounds;
 		for (int i = 0; i < size; i++)
 		{
-			objects[i]->intersect(r, h, tmin);
+			BBox box;
+			if (objects[i]->getBounds(box))
+			{
+				boundedObjects.push_back(objects[i]);
+				primBounds.push_back(box);
+				bounds.extend(box);
+			}
+			else
+			{
+				unbounded.add(objects[i]);
+			}
+		}
+		bvh.build(primBounds, 4, quality);
+		// store the primitives in leaf order so a leaf reads one run of
+		// each array, then index them directly
+		leafOrder.resize(bvh.primIndices.size());
+		for (unsigned int i = 0; i < bvh.primIndices.size(); i++)
+		{
+			leafOrder[i] = boundedObjects[bvh.primIndices[i]];
+			bounded.add(leafOrder[i]);
+			bvh.primIndices[i] = i;
 		}
+		hasBVH = true;
+	}
 
+	///refits the children, copies the moved primitives again and
+	///refits the BVH over them without rebuilding it
+	virtual void refit() {
+		if (!hasBVH)
+		{
+			return;
+		}
+		bounded.clear();
+		unbounded.clear();
+		bounds = BBox();
+		std::vector<BBox> primBounds(leafOrder.size());
+		for (unsigned int i = 0; i < leafOrder.size(); i++)
+		{
+			leafOrder[i]->refit();
+			leafOrder[i]->getBounds(primBounds[i]);
+			bounds.extend(primBounds[i]);
+			bounded.add(leafOrder[i]);
+		}
+		for (int i = 0; i < size; i++)
+		{
+			BBox box;
+			if (!objects[i]->getBounds(box))
+			{
+				objects[i]->refit();
+				unbounded.add(objects[i]);
+			}
+		}
+		bvh.refit(primBounds);
+	}
+
+	virtual bool getBounds(BBox& box) const {
+		if (!hasBVH || unbounded.size() > 0 || bounded.size() == 0)
+		{
+			return false;
+		}
+		box = bounds;
 		return true;
 	}
 
@@ -59,20 +345,48 @@ public:
 		{
 			return;
 		}
-		
-		delete objects[index];
+
 		objects[index] = obj;
+		if (index >= size)
+		{
+			size = index + 1;
+		}
+		hasBVH = false;
 	}
 
 	int getGroupSize() {
 		return size;
 	}
 
+	Object3D* getObject(int index) const {
+		return objects[index];
+	}
+
 private:
 	Object3D** objects;
 	int size;
 	int capacity;
 
+	BVH bvh;
+	bool hasBVH = false;
+	BBox bounds;
+	PrimitiveSet bounded;
+	PrimitiveSet unbounded;
+	// the bounded children in the order of bounded
+	std::vector<Object3D*> leafOrder;
+
+#ifdef RT_USE_SSE
+	static void pushPacket(HitPacket& h, int mask, int i) {
+		for (int j = 0; j < PACKET_SIZE; j++)
+		{
+			if (mask & (1 << j))
+			{
+				h[j].push(i);
+			}
+		}
+	}
+#endif
+
 	void resize() {
 		capacity *= 2;
 		Object3D** newObjs = new Object3D * [capacity];
@@ -80,6 +394,10 @@ private:
 		{
 			newObjs[i] = objects[i];
 		}
+		for (int i = size; i < capacity; i++)
+		{
+			newObjs[i] = NULL;
+		}
 		delete[] objects;
 		objects = newObjs;
 		newObjs = nullptr;
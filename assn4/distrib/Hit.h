@@ -4,74 +4,236 @@
 #include <vecmath.h>
 #include "Ray.h"
 #include <float.h>
+#include <cassert>
 
 class Material;
 
-class Hit
+///deepest nesting of groups a hit can be resolved through, SceneParser
+///rejects deeper scenes
+#define HIT_MAX_DEPTH 16
+
+///What traversal writes for the closest hit so far: t, the primitive and
+///its barycentrics. Closer hits overwrite it.
+struct HitRecord
+{
+    float t;
+    int primID;
+    float beta, gamma;
+};
+
+///What Object3D::getAttributes computes, for the closest hit only.
+struct HitAttributes
+{
+    Material* material;
+    Vector3f normal;
+    bool hasTex;
+    Vector2f texCoord;
+    ///texture coordinate units per world unit around the hit, 0 if unknown
+    float texScale;
+    ///width of the pixel footprint in texture coordinates, set by the
+    ///tracer before shading; 0 samples the finest mip level
+    float texFootprint;
+};
+
+///The index of the child that was hit, pushed by every object with
+///several children on top of the primitive's record, so getAttributes
+///can walk back down to it. It is only needed from intersect() to
+///getAttributes(), so the caller running both owns one per ray in
+///flight instead of every Hit carrying it.
+class HitPath
 {
 public:
 
-    // constructors
-    Hit()
+    HitPath()
     {
-        material = NULL;
-		t = FLT_MAX;
-		hasTex=false;
+        depth = 0;
     }
 
-    Hit( float _t, Material* m, const Vector3f& n )
-    { 
-        t = _t;
-        material = m;
-        normal = n;
-		hasTex=false;
+    void clear()
+    {
+        depth = 0;
     }
 
-    Hit( const Hit& h )
-    { 
-        t = h.t; 
-        material = h.material; 
-        normal = h.normal;
-		hasTex=h.hasTex;
+    ///like Occluder::push, a tree nested deeper than HIT_MAX_DEPTH only
+    ///counts the extra levels, whose indices are then lost
+    void push( int i )
+    {
+        if( depth < HIT_MAX_DEPTH )
+        {
+            path[ depth ] = i;
+        }
+        depth++;
     }
 
-    // destructor
-    ~Hit()
+    ///the child index the matching push() stored, outermost first;
+    ///false if that push lay beyond HIT_MAX_DEPTH and stored nothing
+    bool pop( int& i )
     {
-    
+        assert( depth > 0 );
+        if( depth <= 0 || --depth >= HIT_MAX_DEPTH )
+        {
+            return false;
+        }
+        i = path[ depth ];
+        return true;
+    }
+
+private:
+
+    int depth;
+    int path[ HIT_MAX_DEPTH ];
+
+};
+
+///A hit is filled in two stages. While tracing, intersect() only writes
+///the HitRecord, and objects with several children push the child that
+///was hit on the HitPath set with setPath(). Once the closest hit is
+///known, Object3D::getAttributes pops the path and fills the
+///HitAttributes for it alone.
+class Hit
+{
+public:
+
+    // constructors
+    Hit()
+    {
+        init( FLT_MAX, NULL, Vector3f( 0, 0, 0 ) );
+    }
+
+    Hit( float _t, Material* m, const Vector3f& n )
+    {
+        init( _t, m, n );
     }
 
     float getT() const
     {
-        return t;
+        return closest.t;
     }
     
     Material* getMaterial() const
     {
-        return material;
+        return attributes.material;
     }
     
     const Vector3f& getNormal() const
     {
-        return normal;
+        return attributes.normal;
+    }
+
+    ///index of the primitive within the object that recorded the hit
+    int getPrimID() const
+    {
+        return closest.primID;
+    }
+
+    ///barycentric coordinates of vertex 1 and 2, for triangles
+    float getBeta() const
+    {
+        return closest.beta;
+    }
+
+    float getGamma() const
+    {
+        return closest.gamma;
+    }
+
+    ///records a closer hit of a primitive, replacing the previous one
+    ///and the path to it
+    void record( float _t, int prim = -1, float _beta = 0, float _gamma = 0 )
+    {
+        closest.t = _t;
+        closest.primID = prim;
+        closest.beta = _beta;
+        closest.gamma = _gamma;
+        if( path != NULL )
+        {
+            path->clear();
+        }
+    }
+
+    ///where push() and pop() go while the hit is traced and resolved,
+    ///NULL once the attributes are known
+    void setPath( HitPath* p )
+    {
+        path = p;
+        if( path != NULL )
+        {
+            path->clear();
+        }
+    }
+
+    ///called by an object with several children after child i recorded a hit
+    void push( int i )
+    {
+        assert( path != NULL );
+        path->push( i );
+    }
+
+    bool pop( int& i )
+    {
+        assert( path != NULL );
+        return path->pop( i );
     }
 
     void set( float _t, Material* m, const Vector3f& n )
     {
-        t = _t;
-        material = m;
-        normal = n;
+        closest.t = _t;
+        attributes.material = m;
+        attributes.normal = n;
     }
-	void setTexCoord(const Vector2f & coord){
-		texCoord = coord;
-		hasTex = true;
-	}
-	bool hasTex;
-	Vector2f texCoord;
+
+    ///@param scale texture coordinate units per world unit around the hit,
+    ///0 if unknown
+    void setTexCoord( const Vector2f& coord, float scale = 0 )
+    {
+        attributes.texCoord = coord;
+        attributes.texScale = scale;
+        attributes.hasTex = true;
+    }
+
+    bool hasTexCoord() const
+    {
+        return attributes.hasTex;
+    }
+
+    const Vector2f& getTexCoord() const
+    {
+        return attributes.texCoord;
+    }
+
+    float getTexScale() const
+    {
+        return attributes.texScale;
+    }
+
+    float getTexFootprint() const
+    {
+        return attributes.texFootprint;
+    }
+
+    void setTexFootprint( float footprint )
+    {
+        attributes.texFootprint = footprint;
+    }
+
 private:
-	float t;
-    Material* material;
-    Vector3f normal;
+
+    void init( float _t, Material* m, const Vector3f& n )
+    {
+        closest.t = _t;
+        closest.primID = -1;
+        closest.beta = closest.gamma = 0;
+        attributes.material = m;
+        attributes.normal = n;
+        attributes.hasTex = false;
+        attributes.texScale = 0;
+        attributes.texFootprint = 0;
+        path = NULL;
+    }
+
+    HitRecord closest;
+    HitAttributes attributes;
+    HitPath* path;
 
 };
 
@@ -81,4 +243,71 @@ inline ostream& operator << ( ostream &os, const Hit& h)
     return os;
 }
 
+///What blocked a shadow ray, recorded by Object3D::findOccluder the way
+///intersect() records a hit: the primitive, and the index of the child
+///each object with several children pushed on top of it. Passed back to
+///Object3D::occludedBy, it leads to that one primitive again.
+class Occluder
+{
+public:
+
+    Occluder()
+    {
+        primID = -1;
+        depth = 0;
+    }
+
+    ///@param prim primitive of the object that blocked the ray, -1 for
+    ///the whole object
+    void record( int prim = -1 )
+    {
+        primID = prim;
+        depth = 0;
+    }
+
+    ///called by an object with several children after child i blocked the
+    ///ray. SceneParser keeps groups within HIT_MAX_DEPTH; a deeper tree
+    ///built in code only counts the extra levels and leaves the occluder
+    ///invalid instead of writing past the path.
+    void push( int i )
+    {
+        if( depth < HIT_MAX_DEPTH )
+        {
+            path[ depth ] = i;
+        }
+        depth++;
+    }
+
+    ///false if more children were pushed than the path holds
+    bool isValid() const
+    {
+        return depth <= HIT_MAX_DEPTH;
+    }
+
+    int getPrimID() const
+    {
+        return primID;
+    }
+
+    ///number of pushes, the level the outermost object reads
+    int getDepth() const
+    {
+        return depth;
+    }
+
+    ///the child index pushed by the object at level, 1 for the innermost
+    int getChild( int level ) const
+    {
+        assert( level > 0 && level <= depth );
+        return path[ level - 1 ];
+    }
+
+private:
+
+    int primID;
+    int depth;
+    int path[ HIT_MAX_DEPTH ];
+
+};
+
 #endif // HIT_H
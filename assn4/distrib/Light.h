@@ -2,6 +2,7 @@
 #define LIGHT_H
 
 #include <Vector3f.h>
+#include <float.h>
 
 #include "Object3D.h"
 
@@ -21,6 +22,15 @@ public:
 
     virtual void getIllumination( const Vector3f& p, Vector3f& dir, Vector3f& col, float& distanceToLight ) const = 0;
 
+    ///@return false for lights that have no position, like directional ones
+    virtual bool getPosition( Vector3f& /*position*/ ) const
+    {
+        return false;
+    }
+
+    ///brightness used to pick among lights, the mean of the color channels
+    virtual float getPower() const = 0;
+
 };
 
 class DirectionalLight : public Light
@@ -45,6 +55,12 @@ public:
         // direction of the directional light source
         dir = -direction;
         col = color;
+        distanceToLight = FLT_MAX;
+    }
+
+    virtual float getPower() const
+    {
+        return ( color[0] + color[1] + color[2] ) / 3;
     }
 
 private:
@@ -76,10 +92,22 @@ public:
         // the direction to the light is the opposite of the
         // direction of the directional light source
 		dir = (position-p);
-		dir = dir/dir.abs();
+		distanceToLight = dir.abs();
+		dir = dir/distanceToLight;
         col = color;
     }
 
+    virtual bool getPosition( Vector3f& p ) const
+    {
+        p = position;
+        return true;
+    }
+
+    virtual float getPower() const
+    {
+        return ( color[0] + color[1] + color[2] ) / 3;
+    }
+
 private:
 
     PointLight(); // don't use
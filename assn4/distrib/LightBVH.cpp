@@ -0,0 +1,129 @@
+#include "LightBVH.h"
+#include "Light.h"
+#include <algorithm>
+#include <cmath>
+
+// lower bound on the squared distance to a node, so a shading point on
+// top of a light does not make it infinitely important
+#define LIGHT_BVH_MIN_DISTANCE2 1e-8f
+
+void LightBVH::build( const std::vector< Light* >& lights )
+{
+    this->lights = lights;
+    nodes.clear();
+    if( lights.empty() )
+    {
+        return;
+    }
+    std::vector< BuildLight > items( lights.size() );
+    for( int i = 0; i < ( int )lights.size(); i++ )
+    {
+        lights[i]->getPosition( items[i].position );
+        items[i].index = i;
+    }
+    nodes.reserve( 2 * lights.size() - 1 );
+    buildNode( items, 0, ( int )items.size() );
+}
+
+// median splits along the longest axis of the light positions: lights
+// close to each other share subtrees, and the depth stays log2(n)
+int LightBVH::buildNode( std::vector< BuildLight >& items, int begin, int end )
+{
+    int index = ( int )nodes.size();
+    nodes.push_back( Node() );
+    BBox bounds;
+    for( int i = begin; i < end; i++ )
+    {
+        bounds.extend( items[i].position );
+    }
+    nodes[ index ].center = bounds.getCentroid();
+    nodes[ index ].radius = 0.5f * bounds.getExtent().abs();
+    if( end - begin == 1 )
+    {
+        nodes[ index ].power = std::max( lights[ items[ begin ].index ]->getPower(), 0.0f );
+        nodes[ index ].child = -1 - items[ begin ].index;
+        return index;
+    }
+
+    int axis = bounds.maxExtent();
+    int mid = begin + ( end - begin ) / 2;
+    std::nth_element( items.begin() + begin, items.begin() + mid, items.begin() + end,
+        [axis]( const BuildLight& a, const BuildLight& b ) {
+            return a.position[ axis ] < b.position[ axis ];
+        } );
+    int first = buildNode( items, begin, mid );
+    int second = buildNode( items, mid, end );
+    nodes[ index ].power = nodes[ first ].power + nodes[ second ].power;
+    nodes[ index ].child = second;
+    return index;
+}
+
+// power over squared distance times the largest cosine between n and a
+// direction into the node's bounding sphere, which is
+//   cos( angle to the center - half angle of the sphere )
+// Zero when the whole sphere is behind the surface, where no light of the
+// node shades it.
+float LightBVH::importance( const Node& node, const Vector3f& p, const Vector3f& n ) const
+{
+    Vector3f d = node.center - p;
+    float distance2 = d.absSquared();
+    float radius2 = node.radius * node.radius;
+    if( distance2 <= radius2 )
+    {
+        // p is inside the sphere, every direction may see a light
+        return node.power / std::max( radius2, LIGHT_BVH_MIN_DISTANCE2 );
+    }
+    // the cosines and sines below, times the distance to the center
+    float cosine = Vector3f::dot( n, d );
+    if( cosine <= -node.radius )
+    {
+        return 0;
+    }
+    float tangent = sqrt( distance2 - radius2 );
+    float bound = distance2;
+    if( cosine < tangent )
+    {
+        float sine = sqrt( std::max( distance2 - cosine * cosine, 0.0f ) );
+        bound = cosine * tangent + sine * node.radius;
+    }
+    distance2 = std::max( distance2, LIGHT_BVH_MIN_DISTANCE2 );
+    return node.power * bound / ( distance2 * distance2 );
+}
+
+Light* LightBVH::sample( const Vector3f& p, const Vector3f& n, float u, float& pdf ) const
+{
+    pdf = 1;
+    if( nodes.empty() )
+    {
+        return NULL;
+    }
+    int i = 0;
+    while( nodes[i].child >= 0 )
+    {
+        int first = i + 1;
+        int second = nodes[i].child;
+        float a = importance( nodes[ first ], p, n );
+        float b = importance( nodes[ second ], p, n );
+        if( !( a + b > 0 ) )
+        {
+            return NULL;
+        }
+        // u picks a child and is then stretched back to [0, 1) for the
+        // next level
+        float pFirst = a / ( a + b );
+        if( u < pFirst )
+        {
+            u /= pFirst;
+            pdf *= pFirst;
+            i = first;
+        }
+        else
+        {
+            u = ( u - pFirst ) / ( 1 - pFirst );
+            pdf *= 1 - pFirst;
+            i = second;
+        }
+        u = std::min( u, 0.99999994f );
+    }
+    return lights[ -1 - nodes[i].child ];
+}
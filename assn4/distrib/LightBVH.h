@@ -0,0 +1,64 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include <vector>
+#include <vecmath.h>
+#include "BBox.h"
+
+class Light;
+
+///Binary tree over lights that have a position, every node with the
+///bounds and the total power of the lights below it. sample() walks from
+///the root down to one light, picking a child at each node with a
+///probability that follows how much light the node may send to the
+///shading point. A light is picked in O(log n) steps, so shading with a
+///few samples costs the same with ten lights or ten thousand.
+class LightBVH
+{
+public:
+
+    LightBVH() {}
+
+    ///@param lights lights with a position, getPosition must succeed
+    void build( const std::vector< Light* >& lights );
+
+    int size() const
+    {
+        return ( int )lights.size();
+    }
+
+    ///picks a light for the point p with unit normal n
+    ///@param u uniform in [0, 1)
+    ///@param pdf probability that light was picked
+    ///@return NULL when no light in the tree is in front of the surface
+    Light* sample( const Vector3f& p, const Vector3f& n, float u, float& pdf ) const;
+
+private:
+
+    ///a node is bounded by the sphere around the box of its lights
+    struct Node
+    {
+        Vector3f center;
+        float radius;
+        float power;
+        // interior nodes: the second child, the first one follows the node;
+        // leaves: -1 - index of the light
+        int child;
+    };
+
+    struct BuildLight
+    {
+        Vector3f position;
+        int index;
+    };
+
+    // appends the subtree over [begin, end) depth first, returns its root
+    int buildNode( std::vector< BuildLight >& items, int begin, int end );
+    // upper bound on the light the node sends to p, up to a constant
+    float importance( const Node& node, const Vector3f& p, const Vector3f& n ) const;
+
+    std::vector< Node > nodes;
+    std::vector< Light* > lights;
+};
+
+#endif // LIGHT_BVH_H
@@ -0,0 +1,60 @@
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile( const char* filename ) : data( NULL ), size( 0 )
+{
+#ifdef _WIN32
+    FILE* file = fopen( filename, "rb" );
+    if( file == NULL )
+    {
+        return;
+    }
+    fseek( file, 0, SEEK_END );
+    long len = ftell( file );
+    fseek( file, 0, SEEK_SET );
+    if( len > 0 )
+    {
+        buffer.resize( len );
+        if( fread( &buffer[0], 1, len, file ) == ( size_t )len )
+        {
+            data = &buffer[0];
+            size = len;
+        }
+    }
+    fclose( file );
+#else
+    int fd = open( filename, O_RDONLY );
+    if( fd < 0 )
+    {
+        return;
+    }
+    struct stat st;
+    if( fstat( fd, &st ) == 0 && st.st_size > 0 )
+    {
+        void* p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( p != MAP_FAILED )
+        {
+            data = ( const char* )p;
+            size = st.st_size;
+        }
+    }
+    close( fd );
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if( data != NULL )
+    {
+        munmap( ( void* )data, size );
+    }
+#endif
+}
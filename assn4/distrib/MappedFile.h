@@ -0,0 +1,31 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <vector>
+
+///Read-only view of a whole file, memory mapped where the platform
+///supports it and read into memory otherwise.
+///data is NULL if the file could not be opened or is empty.
+class MappedFile
+{
+public:
+
+    MappedFile( const char* filename );
+    ~MappedFile();
+
+    const char* data;
+    size_t size;
+
+private:
+
+    MappedFile( const MappedFile& );
+    MappedFile& operator = ( const MappedFile& );
+
+#ifdef _WIN32
+    std::vector< char > buffer;
+#endif
+
+};
+
+#endif // MAPPED_FILE_H
@@ -2,19 +2,20 @@
 #define MATERIAL_H
 
 #include <cassert>
+#include <cmath>
 #include <vecmath.h>
 
 #include "Ray.h"
 #include "Hit.h"
 #include "texture.hpp"
-///TODO:
-///Implement Shade function that uses ambient, diffuse, specular and texture
+///Phong material with an optional diffuse texture
 class Material
 {
 public:
 	
  Material( const Vector3f& d_color ,const Vector3f& s_color=Vector3f::ZERO, float s=0):
-  diffuseColor( d_color),specularColor(s_color), shininess(s)
+  diffuseColor( d_color),specularColor(s_color), reflectiveColor(Vector3f::ZERO),
+  transparentColor(Vector3f::ZERO), indexOfRefraction(1), shininess(s)
   {
         	
   }
@@ -30,10 +31,62 @@ public:
   }
     
 
+  ///diffuse color at the hit, looked up in the texture if there is one,
+  ///filtered over hit.texFootprint
+  Vector3f getDiffuseColor( const Hit& hit )
+  {
+    if( t.valid() && hit.hasTexCoord() ){
+      return t.sample( hit.getTexCoord()[0], hit.getTexCoord()[1], hit.getTexFootprint() );
+    }
+    return diffuseColor;
+  }
+
+  ///color mirror reflections are tinted with, zero for no reflection
+  const Vector3f& getReflectiveColor() const
+  {
+    return reflectiveColor;
+  }
+
+  void setReflectiveColor( const Vector3f& r_color )
+  {
+    reflectiveColor = r_color;
+  }
+
+  ///color refracted light is tinted with, zero for an opaque material
+  const Vector3f& getTransparentColor() const
+  {
+    return transparentColor;
+  }
+
+  float getIndexOfRefraction() const
+  {
+    return indexOfRefraction;
+  }
+
+  void setTransparency( const Vector3f& t_color, float ior )
+  {
+    transparentColor = t_color;
+    indexOfRefraction = ior;
+  }
+
   Vector3f Shade( const Ray& ray, const Hit& hit,
                   const Vector3f& dirToLight, const Vector3f& lightColor ) {
 
-    return Vector3f(1,1,1) ; 
+    const Vector3f& n = hit.getNormal();
+    float diffuse = Vector3f::dot( dirToLight, n );
+    if( diffuse <= 0 ){
+      return Vector3f::ZERO;
+    }
+    Vector3f color = diffuse * getDiffuseColor( hit );
+
+    if( shininess > 0 ){
+      Vector3f reflected = 2 * diffuse * n - dirToLight;
+      float specular = -Vector3f::dot( reflected, ray.getDirection().normalized() );
+      if( specular > 0 ){
+        color += pow( specular, shininess ) * specularColor;
+      }
+    }
+    return color * lightColor ; 
 		
   }
 
@@ -43,6 +96,9 @@ public:
  protected:
   Vector3f diffuseColor;
   Vector3f specularColor;
+  Vector3f reflectiveColor;
+  Vector3f transparentColor;
+  float indexOfRefraction;
   float shininess;
   Texture t;
 };
@@ -1,96 +1,493 @@
 #include "Mesh.hpp"
-#include <fstream>
-#include <iostream>
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include <cstdio>
 #include <algorithm>
+#include <charconv>
 #include <cstdlib>
+#include <cstring>
 #include <utility>
-#include <sstream>
+#ifdef RT_USE_SSE
 bool Mesh ::intersect( const Ray& r , Hit& h , float tmin ) {
-	bool result = false;
-	for( unsigned int i = 0 ; i < t.size() ; i++){
-		Triangle triangle(v[t[i][0]],
-			v[t[i][1]],v[t[i][2]],material);
-		for(int jj=0;jj<3;jj++){
-			triangle.normals[jj] = n[t[i][jj]];
+	__m128 o[3], d[3];
+	for(int k=0; k<3; k++) {
+		o[k] = _mm_set1_ps(r.getOrigin()[k]);
+		d[k] = _mm_set1_ps(r.getDirection()[k]);
+	}
+	__m128 tmin4 = _mm_set1_ps(tmin);
+	//leaves start on a block, each block tests four triangles at once
+	return bvh.intersectLeaves( r , h , tmin , [&](int first, int count) {
+		bool result = false;
+		for(int ii=0; ii<count; ii+=4) {
+			__m128 t, beta, gamma;
+			int mask = Triangle::intersectTriangles(o, d, blocks[(first+ii)/4], tmin4,
+				_mm_set1_ps(h.getT()), t, beta, gamma);
+			mask &= (1 << std::min(count-ii, 4)) - 1;
+			if(!mask) {
+				continue;
+			}
+			float ts[4], bs[4], gs[4];
+			_mm_storeu_ps(ts, t);
+			_mm_storeu_ps(bs, beta);
+			_mm_storeu_ps(gs, gamma);
+			int best = -1;
+			for(int jj=0; jj<4; jj++) {
+				if((mask & (1 << jj)) && (best < 0 || ts[jj] < ts[best])) {
+					best = jj;
+				}
+			}
+			h.record(ts[best], first + ii + best, bs[best], gs[best]);
+			result = true;
+		}
+		return result;
+	});
+}
 
+bool Mesh::occluded( const Ray& r , float tmin , float tmax ) {
+	__m128 o[3], d[3];
+	for(int k=0; k<3; k++) {
+		o[k] = _mm_set1_ps(r.getOrigin()[k]);
+		d[k] = _mm_set1_ps(r.getDirection()[k]);
+	}
+	__m128 tmin4 = _mm_set1_ps(tmin), tmax4 = _mm_set1_ps(tmax);
+	return bvh.occludedLeaves( r , tmin , tmax , [&](int first, int count) {
+		for(int ii=0; ii<count; ii+=4) {
+			__m128 t, beta, gamma;
+			int mask = Triangle::intersectTriangles(o, d, blocks[(first+ii)/4], tmin4, tmax4, t, beta, gamma);
+			if(mask & ((1 << std::min(count-ii, 4)) - 1)) {
+				return true;
+			}
 		}
-		if(texCoord.size()>0){
-			for(int jj=0;jj<3;jj++){
-				triangle.texCoords[jj] = texCoord[t[i].texID[jj]];
+		return false;
+	});
+}
+
+bool Mesh::findOccluder( const Ray& r , float tmin , float tmax , Occluder& occ ) {
+	__m128 o[3], d[3];
+	for(int k=0; k<3; k++) {
+		o[k] = _mm_set1_ps(r.getOrigin()[k]);
+		d[k] = _mm_set1_ps(r.getDirection()[k]);
+	}
+	__m128 tmin4 = _mm_set1_ps(tmin), tmax4 = _mm_set1_ps(tmax);
+	return bvh.occludedLeaves( r , tmin , tmax , [&](int first, int count) {
+		for(int ii=0; ii<count; ii+=4) {
+			__m128 t, beta, gamma;
+			int mask = Triangle::intersectTriangles(o, d, blocks[(first+ii)/4], tmin4, tmax4, t, beta, gamma);
+			mask &= (1 << std::min(count-ii, 4)) - 1;
+			if(mask) {
+				occ.record(first + ii + __builtin_ctz(mask));
+				return true;
 			}
-			triangle.hasTex=true;
 		}
-		result |= triangle.intersect( r , h , tmin);
+		return false;
+	});
+}
+
+//tests the whole block of the recorded triangle, the padding lanes
+//repeat triangles of the same leaf
+bool Mesh::occludedBy( const Ray& r , float tmin , float tmax , const Occluder& occ , int /*level*/ ) {
+	__m128 o[3], d[3];
+	for(int k=0; k<3; k++) {
+		o[k] = _mm_set1_ps(r.getOrigin()[k]);
+		d[k] = _mm_set1_ps(r.getDirection()[k]);
 	}
-	return result;
+	__m128 t, beta, gamma;
+	return Triangle::intersectTriangles(o, d, blocks[occ.getPrimID()/4], _mm_set1_ps(tmin),
+		_mm_set1_ps(tmax), t, beta, gamma) != 0;
+}
+#else
+bool Mesh ::intersect( const Ray& r , Hit& h , float tmin ) {
+	return bvh.intersect( r , h , tmin , [&](int i) {
+		const MeshTriangle& tri = tris[i];
+		float t, beta, gamma;
+		if(!Triangle::intersectTriangle(r, tri.v0, tri.e1, tri.e2, tmin, h.getT(), t, beta, gamma)) {
+			return false;
+		}
+		h.record(t, i, beta, gamma);
+		return true;
+	});
+}
+
+bool Mesh::occluded( const Ray& r , float tmin , float tmax ) {
+	return bvh.occluded( r , tmin , tmax , [&](int i) {
+		const MeshTriangle& tri = tris[i];
+		float t, beta, gamma;
+		return Triangle::intersectTriangle(r, tri.v0, tri.e1, tri.e2, tmin, tmax, t, beta, gamma);
+	});
+}
+
+bool Mesh::findOccluder( const Ray& r , float tmin , float tmax , Occluder& o ) {
+	return bvh.occluded( r , tmin , tmax , [&](int i) {
+		const MeshTriangle& tri = tris[i];
+		float t, beta, gamma;
+		if(!Triangle::intersectTriangle(r, tri.v0, tri.e1, tri.e2, tmin, tmax, t, beta, gamma)) {
+			return false;
+		}
+		o.record(i);
+		return true;
+	});
+}
+
+bool Mesh::occludedBy( const Ray& r , float tmin , float tmax , const Occluder& o , int /*level*/ ) {
+	const MeshTriangle& tri = tris[o.getPrimID()];
+	float t, beta, gamma;
+	return Triangle::intersectTriangle(r, tri.v0, tri.e1, tri.e2, tmin, tmax, t, beta, gamma);
 }
-Mesh::Mesh(const char * filename,Material * material):Object3D(material)
+#endif
+
+
+#ifdef RT_USE_SSE
+int Mesh::intersectPacket( const RayPacket& p , HitPacket& h , float tmin ) {
+	__m128 tmin4 = _mm_set1_ps(tmin);
+	return bvh.intersectPacket( p , h , tmin , [&](int i) {
+		const MeshTriangle& tri = tris[i];
+		__m128 t, beta, gamma;
+		int hitMask = Triangle::intersectTriangle(p, tri.v0, tri.e1, tri.e2, tmin4, h.getT(), t, beta, gamma);
+		if(!hitMask) {
+			return 0;
+		}
+		float ts[4], bs[4], gs[4];
+		_mm_storeu_ps(ts, t);
+		_mm_storeu_ps(bs, beta);
+		_mm_storeu_ps(gs, gamma);
+		for(int jj=0; jj<PACKET_SIZE; jj++) {
+			if(hitMask & (1 << jj)) {
+				h[jj].record(ts[jj], i, bs[jj], gs[jj]);
+			}
+		}
+		return hitMask;
+	});
+}
+#endif
+
+void Mesh::getAttributes( const Ray& /*r*/ , Hit& h ) {
+	int tri = h.getPrimID();
+	float beta = h.getBeta(), gamma = h.getGamma();
+	Trig& trig = t[tris[tri].id];
+	float alpha = 1 - beta - gamma;
+	Vector3f normal = alpha * n[trig[0]] + beta * n[trig[1]] + gamma * n[trig[2]];
+	h.set(h.getT(), material, normal.normalized());
+	if(texCoord.size()>0){
+		const Vector2f & t0 = texCoord[trig.texID[0]];
+		Vector2f t1 = texCoord[trig.texID[1]] - t0;
+		Vector2f t2 = texCoord[trig.texID[2]] - t0;
+		// texture units per world unit, from the areas the face covers in both
+		float worldArea = Vector3f::cross(tris[tri].e1, tris[tri].e2).abs();
+		float scale = worldArea > 0 ? sqrt(fabs(t1[0] * t2[1] - t1[1] * t2[0]) / worldArea) : 0;
+		h.setTexCoord(alpha * t0
+			+ beta * texCoord[trig.texID[1]]
+			+ gamma * texCoord[trig.texID[2]], scale);
+	}
+}
+
+namespace {
+	const char * skip_space(const char * p, const char * end) {
+		while(p<end && (*p==' ' || *p=='\t' || *p=='\r')) {
+			p++;
+		}
+		return p;
+	}
+
+	const char * parse_float(const char * p, const char * end, float & out) {
+		p = skip_space(p,end);
+		if(p<end && *p=='+') {
+			p++;
+		}
+		std::from_chars_result res = std::from_chars(p,end,out);
+		if(res.ec!=std::errc()) {
+			out = 0;
+			return p;
+		}
+		return res.ptr;
+	}
+
+	const char * parse_int(const char * p, const char * end, int & out) {
+		std::from_chars_result res = std::from_chars(p,end,out);
+		if(res.ec!=std::errc()) {
+			out = 0;
+			return p;
+		}
+		return res.ptr;
+	}
+
+	///obj index to 0-based: positive counts from the first element of the
+	///file, negative back from the last one read so far. 0 and parse
+	///failures give -1, which the face check after parsing rejects.
+	int absolute_index(int index, int readSoFar) {
+		return index>0 ? index-1 : (index<0 ? readSoFar+index : -1);
+	}
+
+	///one face corner: v, v/t, v/t/n or v//n, indices converted to 0-based;
+	///numVerts and numTex are the vertices and texture coordinates before it
+	const char * parse_corner(const char * p, const char * end, int numVerts, int numTex,
+		int & vert, int & tex) {
+		p = parse_int(skip_space(p,end),end,vert);
+		vert = absolute_index(vert,numVerts);
+		tex = 0;
+		if(p<end && *p=='/') {
+			p++;
+			if(p<end && *p!='/') {
+				p = parse_int(p,end,tex);
+				tex = absolute_index(tex,numTex);
+			}
+			if(p<end && *p=='/') {
+				int normal;
+				p = parse_int(p+1,end,normal);
+			}
+		}
+		return p;
+	}
+
+	enum LineType { LINE_OTHER, LINE_VERTEX, LINE_TEXCOORD, LINE_FACE };
+
+	///classifies a line and returns where its data starts in rest
+	LineType line_type(const char * p, const char * end, const char *& rest) {
+		p = skip_space(p,end);
+		if(end-p<3 || *p=='#') {
+			return LINE_OTHER;
+		}
+		if(p[0]=='v' && (p[1]==' ' || p[1]=='\t')) {
+			rest = p+2;
+			return LINE_VERTEX;
+		}
+		if(p[0]=='f' && (p[1]==' ' || p[1]=='\t')) {
+			rest = p+2;
+			return LINE_FACE;
+		}
+		if(p[0]=='v' && p[1]=='t' && (p[2]==' ' || p[2]=='\t')) {
+			rest = p+3;
+			return LINE_TEXCOORD;
+		}
+		return LINE_OTHER;
+	}
+
+	const char * line_end(const char * p, const char * end) {
+		const char * eol = (const char *)memchr(p,'\n',end-p);
+		return eol ? eol : end;
+	}
+
+	///a range of whole lines and how many elements of each kind it holds
+	struct ObjChunk {
+		const char * begin;
+		const char * end;
+		int counts[4];
+		int offsets[4];
+	};
+}
+
+Mesh::Mesh(const char * filename,Material * material,BVH::Quality quality):Object3D(material),quality(quality)
 {
-	std::ifstream f ;
-	f.open(filename);
-	if(!f.is_open()) {
-		std::cout<<"Cannot open "<<filename<<"\n";
+	if(MeshCache::load(filename,*this)) {
+		build_blocks();
 		return;
 	}
-	std::string line;
-	std::string vTok("v");
-	std::string fTok("f");
-	std::string texTok("vt");
-	char bslash='/',space=' ';
-	std::string tok;
-	while(1) {
-		std::getline(f,line);
-		if(f.eof()) {
-			break;
-		}
-		if(line.size()<3) {
-			continue;
-		}
-		if(line.at(0)=='#') {
-			continue;
-		}
-		std::stringstream ss(line);
-		ss>>tok;
-		if(tok==vTok) {
-			Vector3f vec;
-			ss>>vec[0]>>vec[1]>>vec[2];
-			v.push_back(vec);
-		} else if(tok==fTok) {
-			if(line.find(bslash)!=std::string::npos) {
-				std::replace(line.begin(),line.end(),bslash,space);
-				std::stringstream facess(line);
-				Trig trig;
-				facess>>tok;
-				for(int ii=0; ii<3; ii++) {
-					facess>>trig[ii]>>trig.texID[ii];
-					trig[ii]--;
-					trig.texID[ii]--;
-				}
-				t.push_back(trig);
-			} else {
-				Trig trig;
+	MappedFile f(filename);
+	if(f.data==NULL) {
+		fprintf(stderr,"Cannot open %s\n",filename);
+		return;
+	}
+	const char * data = f.data;
+	const char * dataEnd = f.data + f.size;
+
+	//split the file into chunks of whole lines, parsed in parallel
+	ThreadPool & pool = ThreadPool::global();
+	int numChunks = std::max(1, std::min(pool.getNumThreads() * 4, (int)(f.size >> 16)));
+	std::vector<ObjChunk> chunks(numChunks);
+	const char * p = data;
+	for(int ii=0; ii<numChunks; ii++) {
+		chunks[ii].begin = p;
+		if(ii==numChunks-1) {
+			p = dataEnd;
+		} else {
+			p = std::max(p, data + f.size * (ii+1) / numChunks);
+			p = line_end(p,dataEnd);
+			p = p<dataEnd ? p+1 : p;
+		}
+		chunks[ii].end = p;
+	}
+
+	//first pass counts, so the arrays are sized once and each chunk
+	//writes its own slice
+	pool.parallelFor(numChunks, 1, [&](int c) {
+		ObjChunk & chunk = chunks[c];
+		memset(chunk.counts,0,sizeof(chunk.counts));
+		for(const char * line = chunk.begin; line<chunk.end; ) {
+			const char * eol = line_end(line,chunk.end);
+			const char * rest;
+			chunk.counts[line_type(line,eol,rest)]++;
+			line = eol+1;
+		}
+	});
+	int totals[4] = {0,0,0,0};
+	for(int ii=0; ii<numChunks; ii++) {
+		for(int k=0; k<4; k++) {
+			chunks[ii].offsets[k] = totals[k];
+			totals[k] += chunks[ii].counts[k];
+		}
+	}
+	v.resize(totals[LINE_VERTEX]);
+	texCoord.resize(totals[LINE_TEXCOORD]);
+	t.resize(totals[LINE_FACE]);
+
+	pool.parallelFor(numChunks, 1, [&](int c) {
+		ObjChunk & chunk = chunks[c];
+		Vector3f * vOut = v.data() + chunk.offsets[LINE_VERTEX];
+		Vector2f * texOut = texCoord.data() + chunk.offsets[LINE_TEXCOORD];
+		Trig * tOut = t.data() + chunk.offsets[LINE_FACE];
+		for(const char * line = chunk.begin; line<chunk.end; ) {
+			const char * eol = line_end(line,chunk.end);
+			const char * rest;
+			switch(line_type(line,eol,rest)) {
+			case LINE_VERTEX: {
+				Vector3f & vec = *vOut++;
+				rest = parse_float(rest,eol,vec[0]);
+				rest = parse_float(rest,eol,vec[1]);
+				parse_float(rest,eol,vec[2]);
+				break;
+			}
+			case LINE_TEXCOORD: {
+				Vector2f & coord = *texOut++;
+				rest = parse_float(rest,eol,coord[0]);
+				parse_float(rest,eol,coord[1]);
+				break;
+			}
+			case LINE_FACE: {
+				Trig & trig = *tOut++;
+				int numVerts = (int)(vOut - v.data());
+				int numTex = (int)(texOut - texCoord.data());
 				for(int ii=0; ii<3; ii++) {
-					ss>>trig[ii];
-					trig[ii]--;
-					trig.texID[ii]=0;
+					rest = parse_corner(rest,eol,numVerts,numTex,trig[ii],trig.texID[ii]);
 				}
-				t.push_back(trig);
+				break;
+			}
+			default:
+				break;
+			}
+			line = eol+1;
+		}
+	});
+
+	//faces that point outside the arrays would corrupt memory in
+	//compute_norm and the BVH build, so they are dropped
+	int numBad = 0;
+	for(unsigned int ii=0; ii<t.size(); ii++) {
+		if(!valid_face(t[ii])) {
+			if(numBad==0) {
+				fprintf(stderr,"%s: face %u has an index out of range\n",filename,ii+1);
+			}
+			numBad++;
+		} else {
+			t[ii-numBad] = t[ii];
+		}
+	}
+	if(numBad>0) {
+		fprintf(stderr,"%s: skipped %d invalid faces\n",filename,numBad);
+		t.resize(t.size()-numBad);
+	}
+
+	compute_norm();
+	for(unsigned int ii=0; ii<v.size(); ii++) {
+		box.extend(v[ii]);
+	}
+	build_bvh();
+
+	MeshCache::save(filename,*this);
+}
+
+void Mesh::build_bvh()
+{
+	std::vector<BBox> bounds(t.size());
+	for(unsigned int ii=0; ii<t.size(); ii++) {
+		for(int jj=0; jj<3; jj++) {
+			bounds[ii].extend(v[t[ii][jj]]);
+		}
+	}
+	//spatial splits clip the triangles themselves
+	std::vector<Vector3f> corners;
+	if(quality==BVH::SBVH) {
+		corners.resize(3*t.size());
+		for(unsigned int ii=0; ii<t.size(); ii++) {
+			for(int jj=0; jj<3; jj++) {
+				corners[3*ii+jj] = v[t[ii][jj]];
 			}
-		} else if(tok==texTok) {
-			Vector2f texcoord;
-			ss>>texcoord[0];
-			ss>>texcoord[1];
-			texCoord.push_back(texcoord);
 		}
 	}
+	bvh.setLeafBlockSize(4);
+	bvh.build(bounds,4,quality,quality==BVH::SBVH ? &corners : NULL);
+	bvh.alignLeaves();
+
+	//store the triangles in leaf order so each leaf reads a contiguous range;
+	//with spatial splits a triangle may be stored more than once
+	tris.resize(bvh.primIndices.size());
+	for(unsigned int ii=0; ii<bvh.primIndices.size(); ii++) {
+		Trig& trig = t[bvh.primIndices[ii]];
+		tris[ii].v0 = v[trig[0]];
+		tris[ii].e1 = v[trig[1]] - v[trig[0]];
+		tris[ii].e2 = v[trig[2]] - v[trig[0]];
+		tris[ii].id = bvh.primIndices[ii];
+		bvh.primIndices[ii] = ii;
+	}
+	build_blocks();
+}
+
+///copies the triangles of each leaf into SoA blocks of four; leaves are
+///aligned to four triangles, the padding repeats a triangle of the leaf
+void Mesh::build_blocks()
+{
+	blocks.resize(tris.size()/4);
+	for(unsigned int ii=0; ii<blocks.size()*4; ii++) {
+		TriangleBlock& b = blocks[ii/4];
+		for(int k=0; k<3; k++) {
+			b.v0[k][ii%4] = tris[ii].v0[k];
+			b.e1[k][ii%4] = tris[ii].e1[k];
+			b.e2[k][ii%4] = tris[ii].e2[k];
+		}
+	}
+}
+
+void Mesh::refit()
+{
+	std::vector<BBox> bounds(tris.size());
+	box = BBox();
+	for(unsigned int ii=0; ii<tris.size(); ii++) {
+		Trig& trig = t[tris[ii].id];
+		tris[ii].v0 = v[trig[0]];
+		tris[ii].e1 = v[trig[1]] - v[trig[0]];
+		tris[ii].e2 = v[trig[2]] - v[trig[0]];
+		for(int jj=0; jj<3; jj++) {
+			bounds[ii].extend(v[trig[jj]]);
+		}
+		box.extend(bounds[ii]);
+	}
+	bvh.refit(bounds);
+	build_blocks();
 	compute_norm();
+}
 
-	f.close();
+bool Mesh::getBounds( BBox& b ) const
+{
+	if(box.isEmpty()) {
+		return false;
+	}
+	b = box;
+	return true;
+}
+
+bool Mesh::valid_face(const Trig & trig) const
+{
+	for(int k=0; k<3; k++) {
+		if((unsigned int)trig.x[k]>=v.size() ||
+			(texCoord.size()>0 && (unsigned int)trig.texID[k]>=texCoord.size())) {
+			return false;
+		}
+	}
+	return true;
 }
 
 void Mesh::compute_norm()
 {
-	n.resize(v.size());
+	n.assign(v.size(),Vector3f(0,0,0));
 	for(unsigned int ii=0; ii<t.size(); ii++) {
 		Vector3f a = v[t[ii][1]] - v[t[ii][0]];
 		Vector3f b = v[t[ii][2]] - v[t[ii][0]];
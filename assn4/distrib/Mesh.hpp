@@ -0,0 +1,107 @@
+#ifndef MESH_H
+#define MESH_H
+#include <vector>
+#include "Object3D.h"
+#include "Triangle.h"
+#include "BVH.h"
+#include "Vector2f.h"
+#include "Vector3f.h"
+
+
+struct Trig{
+	Trig(){
+		x[0]=0;x[1]=0;x[2]=0;
+	}
+	int &operator[](int ii){return x[ii];}
+	int x[3];
+	int texID[3];
+};
+
+///triangle data prebuilt once at load time, so intersect() copies nothing
+struct MeshTriangle{
+	Vector3f v0;
+	Vector3f e1; //v1 - v0
+	Vector3f e2; //v2 - v0
+	int id; //index into Mesh::t for normals and texture coordinates
+};
+
+class Mesh:public Object3D
+{
+public:
+	///@param quality how the triangle BVH is built
+	Mesh(const char * filename,Material* m,BVH::Quality quality=BVH::SAH);
+	std::vector<Vector3f>v;
+	std::vector<Trig>t;
+	std::vector<Vector3f>n;
+	std::vector<Vector2f>texCoord;
+	bool intersect( const Ray& r , Hit& h , float tmin ) ;
+	///interpolates normal and texture coordinates of the recorded triangle
+	void getAttributes( const Ray& r , Hit& h ) ;
+	bool occluded( const Ray& r , float tmin , float tmax ) ;
+	///records the blocking triangle
+	bool findOccluder( const Ray& r , float tmin , float tmax , Occluder& o ) ;
+	bool occludedBy( const Ray& r , float tmin , float tmax , const Occluder& o , int level ) ;
+	bool getBounds( BBox& b ) const ;
+	///call after moving the vertices in v; the faces must stay the same.
+	///Rebuilds the triangles, the BVH boxes and the vertex normals.
+	void refit();
+#ifdef RT_USE_SSE
+	int intersectPacket( const RayPacket& p , HitPacket& h , float tmin ) ;
+#endif
+private:
+	friend class MeshCache;
+	///every index of the face lies in v and, if there are any, texCoord
+	bool valid_face(const Trig & trig) const;
+	void compute_norm();
+	void build_bvh();
+	void build_blocks();
+	BBox box;
+	BVH::Quality quality;
+	///triangles in BVH leaf order, every leaf starting at a multiple of four
+	std::vector<MeshTriangle> tris;
+	///tris in SoA form, four per block, for the single ray tests
+	std::vector<TriangleBlock> blocks;
+	BVH bvh;
+};
+
+///One reference to a shared Mesh with its own material.
+///SceneParser loads every obj file once and hands out instances, so a
+///mesh used under many Transforms is stored and its BVH built only once;
+///the Group BVH over the Transforms forms the top level.
+///Instances do not refit the mesh, SceneParser::refit does that once per mesh.
+class MeshInstance:public Object3D
+{
+public:
+	MeshInstance(Mesh * mesh,Material* m):Object3D(m),mesh(mesh){}
+	bool intersect( const Ray& r , Hit& h , float tmin ) {
+		return mesh->intersect(r,h,tmin);
+	}
+	void getAttributes( const Ray& r , Hit& h ) {
+		mesh->getAttributes(r,h);
+		h.set(h.getT(),material,h.getNormal());
+	}
+	bool occluded( const Ray& r , float tmin , float tmax ) {
+		return mesh->occluded(r,tmin,tmax);
+	}
+	bool findOccluder( const Ray& r , float tmin , float tmax , Occluder& o ) {
+		return mesh->findOccluder(r,tmin,tmax,o);
+	}
+	bool occludedBy( const Ray& r , float tmin , float tmax , const Occluder& o , int level ) {
+		return mesh->occludedBy(r,tmin,tmax,o,level);
+	}
+#ifdef RT_USE_SSE
+	int intersectPacket( const RayPacket& p , HitPacket& h , float tmin ) {
+		return mesh->intersectPacket(p,h,tmin);
+	}
+#endif
+	bool getBounds( BBox& b ) const {
+		return mesh->getBounds(b);
+	}
+	Mesh* getMesh() const {
+		return mesh;
+	}
+private:
+	Mesh * mesh; //owned by SceneParser
+};
+
+#endif
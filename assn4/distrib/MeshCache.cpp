@@ -0,0 +1,291 @@
+#include "MeshCache.h"
+#include "Mesh.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "MappedFile.h"
+
+// bump whenever the layout of the cache or of the cached types changes
+#define MESH_CACHE_VERSION 4
+
+bool MeshCache::enabled = true;
+
+namespace
+{
+    // the arrays are written as raw memory
+    static_assert( sizeof( Vector3f ) == 3 * sizeof( float ), "Vector3f layout" );
+    static_assert( sizeof( Vector2f ) == 2 * sizeof( float ), "Vector2f layout" );
+    static_assert( sizeof( Trig ) == 6 * sizeof( int ), "Trig layout" );
+    static_assert( sizeof( BVHNode ) == 64, "BVHNode layout" );
+
+    enum
+    {
+        VERTICES, FACES, NORMALS, TEXCOORDS, TRIANGLES, NODES, PRIM_INDICES, NUM_ARRAYS
+    };
+
+    struct CacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t bvhQuality;
+        uint32_t padding;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint64_t sourceHash;
+        uint64_t counts[ NUM_ARRAYS ];
+    };
+
+    std::string cacheName( const char* objFile )
+    {
+        return std::string( objFile ) + ".a4cache";
+    }
+
+    bool statFile( const char* filename, uint64_t& size, int64_t& time )
+    {
+        struct stat st;
+        if( stat( filename, &st ) != 0 )
+        {
+            return false;
+        }
+        size = ( uint64_t )st.st_size;
+        time = ( int64_t )st.st_mtime;
+        return true;
+    }
+
+    // FNV-1a over the whole file
+    uint64_t hashFile( const char* filename )
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        FILE* file = fopen( filename, "rb" );
+        if( file == NULL )
+        {
+            return 0;
+        }
+        unsigned char buffer[ 1 << 16 ];
+        size_t n;
+        while( ( n = fread( buffer, 1, sizeof( buffer ), file ) ) > 0 )
+        {
+            for( size_t i = 0; i < n; i++ )
+            {
+                hash = ( hash ^ buffer[i] ) * 1099511628211ULL;
+            }
+        }
+        fclose( file );
+        return hash;
+    }
+
+    template< class T >
+    bool readArray( const char*& cursor, const char* end, uint64_t count, std::vector< T >& out )
+    {
+        size_t bytes = ( size_t )count * sizeof( T );
+        if( ( size_t )( end - cursor ) < bytes )
+        {
+            return false;
+        }
+        out.resize( ( size_t )count );
+        if( bytes > 0 )
+        {
+            memcpy( ( void* )&out[0], cursor, bytes );
+        }
+        cursor += bytes;
+        return true;
+    }
+
+    template< class T >
+    bool writeArray( FILE* file, const std::vector< T >& in )
+    {
+        if( in.empty() )
+        {
+            return true;
+        }
+        return fwrite( ( const void* )&in[0], sizeof( T ), in.size(), file ) == in.size();
+    }
+}
+
+bool MeshCache::load( const char* objFile, Mesh& mesh )
+{
+    if( !enabled )
+    {
+        return false;
+    }
+    uint64_t size;
+    int64_t time;
+    if( !statFile( objFile, size, time ) )
+    {
+        return false;
+    }
+
+    std::string name = cacheName( objFile );
+    MappedFile cache( name.c_str() );
+    if( cache.data == NULL || cache.size < sizeof( CacheHeader ) )
+    {
+        return false;
+    }
+    CacheHeader header;
+    memcpy( &header, cache.data, sizeof( header ) );
+    if( memcmp( header.magic, "A4MC", 4 ) != 0 || header.version != MESH_CACHE_VERSION ||
+        header.bvhQuality != ( uint32_t )mesh.quality || header.sourceSize != size )
+    {
+        return false;
+    }
+    bool touched = header.sourceTime != time;
+    if( touched && header.sourceHash != hashFile( objFile ) )
+    {
+        return false;
+    }
+
+    const char* cursor = cache.data + sizeof( header );
+    const char* end = cache.data + cache.size;
+    bool ok = readArray( cursor, end, header.counts[ VERTICES ], mesh.v ) &&
+        readArray( cursor, end, header.counts[ FACES ], mesh.t ) &&
+        readArray( cursor, end, header.counts[ NORMALS ], mesh.n ) &&
+        readArray( cursor, end, header.counts[ TEXCOORDS ], mesh.texCoord ) &&
+        readArray( cursor, end, header.counts[ TRIANGLES ], mesh.tris ) &&
+        readArray( cursor, end, header.counts[ NODES ], mesh.bvh.nodes ) &&
+        readArray( cursor, end, header.counts[ PRIM_INDICES ], mesh.bvh.primIndices );
+    if( !ok || !isValid( mesh ) )
+    {
+        fprintf( stderr, "Ignoring %s mesh cache %s\n", ok ? "corrupt" : "truncated", name.c_str() );
+        mesh.v.clear();
+        mesh.t.clear();
+        mesh.n.clear();
+        mesh.texCoord.clear();
+        mesh.tris.clear();
+        mesh.bvh.nodes.clear();
+        mesh.bvh.primIndices.clear();
+        return false;
+    }
+    mesh.box = BBox();
+    for( unsigned int ii = 0; ii < mesh.v.size(); ii++ )
+    {
+        mesh.box.extend( mesh.v[ii] );
+    }
+    if( touched )
+    {
+        // same content under a new time: store the time in place, the
+        // arrays have been copied out of the mapping already
+        header.sourceTime = time;
+        FILE* file = fopen( name.c_str(), "r+b" );
+        if( file != NULL )
+        {
+            fwrite( &header, sizeof( header ), 1, file );
+            fclose( file );
+        }
+    }
+    return true;
+}
+
+bool MeshCache::isValid( const Mesh& mesh )
+{
+    if( mesh.n.size() != mesh.v.size() )
+    {
+        return false;
+    }
+    for( unsigned int ii = 0; ii < mesh.t.size(); ii++ )
+    {
+        if( !mesh.valid_face( mesh.t[ii] ) )
+        {
+            return false;
+        }
+    }
+    for( unsigned int ii = 0; ii < mesh.tris.size(); ii++ )
+    {
+        if( ( unsigned int )mesh.tris[ii].id >= mesh.t.size() )
+        {
+            return false;
+        }
+    }
+#ifdef RT_USE_SSE
+    // build_blocks packs tris four at a time
+    if( mesh.tris.size() % 4 != 0 )
+    {
+        return false;
+    }
+#endif
+    const std::vector< int >& prims = mesh.bvh.primIndices;
+    for( unsigned int ii = 0; ii < prims.size(); ii++ )
+    {
+        if( ( unsigned int )prims[ii] >= mesh.tris.size() )
+        {
+            return false;
+        }
+    }
+    // children come after their parent, which also rules out cycles
+    const std::vector< BVHNode >& nodes = mesh.bvh.nodes;
+    for( unsigned int ii = 0; ii < nodes.size(); ii++ )
+    {
+        const BVHNode& node = nodes[ii];
+        if( node.numChildren > BVH_WIDTH )
+        {
+            return false;
+        }
+        for( int c = 0; c < node.numChildren; c++ )
+        {
+            int child = node.child[c];
+            bool inRange = node.count[c] > 0 ?
+                child >= 0 && ( size_t )child + node.count[c] <= prims.size() :
+                child > ( int )ii && ( size_t )child < nodes.size();
+            if( !inRange )
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void MeshCache::save( const char* objFile, const Mesh& mesh )
+{
+    if( !enabled )
+    {
+        return;
+    }
+    CacheHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, "A4MC", 4 );
+    header.version = MESH_CACHE_VERSION;
+    header.bvhQuality = ( uint32_t )mesh.quality;
+    if( !statFile( objFile, header.sourceSize, header.sourceTime ) )
+    {
+        return;
+    }
+    header.sourceHash = hashFile( objFile );
+    header.counts[ VERTICES ] = mesh.v.size();
+    header.counts[ FACES ] = mesh.t.size();
+    header.counts[ NORMALS ] = mesh.n.size();
+    header.counts[ TEXCOORDS ] = mesh.texCoord.size();
+    header.counts[ TRIANGLES ] = mesh.tris.size();
+    header.counts[ NODES ] = mesh.bvh.nodes.size();
+    header.counts[ PRIM_INDICES ] = mesh.bvh.primIndices.size();
+
+    // write to a temporary name first so a crash never leaves a
+    // half written cache behind
+    std::string name = cacheName( objFile );
+    std::string tmpName = name + ".tmp";
+    FILE* file = fopen( tmpName.c_str(), "wb" );
+    if( file == NULL )
+    {
+        return;
+    }
+    bool ok = fwrite( &header, sizeof( header ), 1, file ) == 1 &&
+        writeArray( file, mesh.v ) &&
+        writeArray( file, mesh.t ) &&
+        writeArray( file, mesh.n ) &&
+        writeArray( file, mesh.texCoord ) &&
+        writeArray( file, mesh.tris ) &&
+        writeArray( file, mesh.bvh.nodes ) &&
+        writeArray( file, mesh.bvh.primIndices );
+    ok = ( fclose( file ) == 0 ) && ok;
+#ifdef _WIN32
+    // rename() does not replace an existing file there
+    remove( name.c_str() );
+#endif
+    if( !ok || rename( tmpName.c_str(), name.c_str() ) != 0 )
+    {
+        remove( tmpName.c_str() );
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+class Mesh;
+
+///Binary cache of a loaded Mesh: the vertex, face, normal and texture
+///arrays plus the built triangle BVH, stored next to the obj file as
+///<file>.a4cache. Loading maps the file and copies the arrays in bulk,
+///with no text parsing and no BVH build.
+///
+///A cache is used only if its version and BVH quality match and it was written from
+///the same source: same size and modification time, or, if only the
+///time differs, the same content hash. A hash match then stores the new
+///time, so the source is hashed once per change of its time.
+class MeshCache
+{
+public:
+
+    ///set to false to always parse the obj file and never write caches
+    static bool enabled;
+
+    ///@return true if mesh was filled from a valid cache for objFile
+    static bool load( const char* objFile, Mesh& mesh );
+
+    ///writes the cache for objFile, silently does nothing on failure
+    static void save( const char* objFile, const Mesh& mesh );
+
+private:
+
+    ///checks that every index the loaded arrays hold is in range, so a
+    ///corrupt cache cannot send traversal or shading out of bounds
+    static bool isValid( const Mesh& mesh );
+
+};
+
+#endif // MESH_CACHE_H
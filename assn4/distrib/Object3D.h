@@ -4,6 +4,8 @@
 #include "Ray.h"
 #include "Hit.h"
 #include "Material.h"
+#include "BBox.h"
+#include "RayPacket.h"
 
 class Object3D
 {
@@ -18,8 +20,72 @@ public:
 	this->material = material ; 
 	}
 	
+	///closest hit test: records t and the primitive in h if the object is
+	///hit in [tmin, h.getT()); the attributes are left to getAttributes()
 	virtual bool intersect( const Ray& r , Hit& h, float tmin) = 0;
 
+	///computes material, normal and texture coordinates of the hit the
+	///last successful intersect() of this object recorded in h. Called
+	///once for the closest hit of a ray, r is the same ray.
+	virtual void getAttributes( const Ray& /*r*/ , Hit& h ){
+		h.set( h.getT() , material , h.getNormal() );
+	}
+
+	///any-hit query: true if the object blocks the ray anywhere in
+	///[tmin, tmax). Implementations return at the first hit they find
+	///and do not compute normals. The default falls back to intersect().
+	virtual bool occluded( const Ray& r , float tmin , float tmax ){
+		Hit h;
+		return intersect( r , h , tmin ) && h.getT() < tmax;
+	}
+
+	///occluded(), also recording in o what blocked the ray, for
+	///occludedBy(). The default records the whole object.
+	virtual bool findOccluder( const Ray& r , float tmin , float tmax , Occluder& o ){
+		if( !occluded( r , tmin , tmax ) ){
+			return false;
+		}
+		o.record();
+		return true;
+	}
+
+	///any-hit test of only what findOccluder() recorded in o, usually
+	///one primitive; objects with children read o.getChild( level ) and
+	///pass level - 1 on. The default tests the whole object.
+	virtual bool occludedBy( const Ray& r , float tmin , float tmax , const Occluder& /*o*/ , int /*level*/ ){
+		return occluded( r , tmin , tmax );
+	}
+
+	///intersects the rays of a packet, updating h[i] for ray i.
+	///The default traces the rays one by one; primitives with a
+	///SIMD test override it.
+	///@return bit i is set if h[i] was updated
+	virtual int intersectPacket( const RayPacket& p, HitPacket& h, float tmin ){
+		int mask = 0;
+		for( int i = 0; i < PACKET_SIZE; i++ ){
+			if( intersect( p.getRay( i ), h[i], tmin ) ){
+				mask |= 1 << i;
+			}
+		}
+		return mask;
+	}
+
+	///axis-aligned bounds of the object
+	///@return false for unbounded objects such as planes,
+	///which are then kept out of acceleration structures
+	virtual bool getBounds( BBox& /*box*/ ) const {
+		return false;
+	}
+
+
+	///updates acceleration structures after the geometry moved, keeping
+	///their topology; called once per frame when animating
+	virtual void refit(){
+	}
+
+	Material* getMaterial() const {
+		return material;
+	}
 
 	char* type;
 protected:
@@ -5,20 +5,88 @@
 #include <vecmath.h>
 #include <cmath>
 using namespace std;
-///TODO: Implement Plane representing an infinite plane
-///choose your representation , add more fields and fill in the functions
+///Plane representing an infinite plane, the points x with dot(normal, x) = d
 class Plane: public Object3D
 {
 public:
 	Plane(){}
 	Plane( const Vector3f& normal , float d , Material* m):Object3D(m){
+		float len = normal.abs();
+		this->normal = normal / len;
+		this->d = d / len;
 	}
 	~Plane(){}
 	virtual bool intersect( const Ray& r , Hit& h , float tmin){
+		float t;
+		if(intersectPlane(r, normal, d, tmin, h.getT(), t)){
+			h.record(t);
+			return true;
+		}
 		return false;
 	}
 
+	virtual void getAttributes( const Ray& /*r*/ , Hit& h){
+		h.set(h.getT(), material, normal);
+	}
+
+	virtual bool occluded( const Ray& r , float tmin , float tmax){
+		float t;
+		return intersectPlane(r, normal, d, tmin, tmax, t);
+	}
+
+	///@return true if the ray crosses the plane dot(normal, x) = d in [tmin, tmax)
+	static bool intersectPlane( const Ray& r, const Vector3f& normal, float d,
+		float tmin, float tmax, float& t){
+		float denom = Vector3f::dot(normal, r.getDirection());
+		if(denom == 0){
+			return false;
+		}
+		t = (d - Vector3f::dot(normal, r.getOrigin())) / denom;
+		return t >= tmin && t < tmax;
+	}
+
+#ifdef RT_USE_SSE
+	virtual int intersectPacket( const RayPacket& p, HitPacket& h, float tmin){
+		__m128 t;
+		int mask = intersectPlane(p, normal, d, _mm_set1_ps(tmin), h.getT(), t);
+		float ts[4];
+		_mm_storeu_ps(ts, t);
+		for(int i = 0; i < PACKET_SIZE; i++){
+			if(mask & (1 << i)){
+				h[i].record(ts[i]);
+			}
+		}
+		return mask;
+	}
+
+	///plane test of the four rays of a packet
+	///@return bit i is set if ray i crosses the plane in [tmin, tmax)
+	static int intersectPlane( const RayPacket& p, const Vector3f& normal, float d,
+		__m128 tmin, __m128 tmax, __m128& t){
+		__m128 denom = _mm_setzero_ps();
+		__m128 dist = _mm_set1_ps(d);
+		for(int k = 0; k < 3; k++){
+			__m128 n = _mm_set1_ps(normal[k]);
+			denom = _mm_add_ps(denom, _mm_mul_ps(n, p.d[k]));
+			dist = _mm_sub_ps(dist, _mm_mul_ps(n, p.o[k]));
+		}
+		t = _mm_div_ps(dist, denom);
+		return _mm_movemask_ps(_mm_and_ps(_mm_cmpneq_ps(denom, _mm_setzero_ps()),
+			_mm_and_ps(_mm_cmpge_ps(t, tmin), _mm_cmplt_ps(t, tmax))));
+	}
+#endif
+
+	const Vector3f& getNormal() const {
+		return normal;
+	}
+
+	float getD() const {
+		return d;
+	}
+
 protected:
+	Vector3f normal;
+	float d;
 };
 #endif //PLANE_H
 		
@@ -0,0 +1,83 @@
+#include "PrimitiveSet.h"
+
+void PrimitiveSet::clear()
+{
+    refs.clear();
+    materials.clear();
+    spheres.clear();
+    planes.clear();
+    triangles.clear();
+    triangleShading.clear();
+    objects.clear();
+}
+
+void PrimitiveSet::add( Object3D* obj )
+{
+    materials.push_back( obj->getMaterial() );
+    if( Sphere* sphere = dynamic_cast< Sphere* >( obj ) )
+    {
+        SphereData s;
+        s.center = sphere->getCenter();
+        s.radius = sphere->getRadius();
+        refs.push_back( ( int )spheres.size() << 2 | SPHERE );
+        spheres.push_back( s );
+    }
+    else if( Plane* plane = dynamic_cast< Plane* >( obj ) )
+    {
+        PlaneData p;
+        p.normal = plane->getNormal();
+        p.d = plane->getD();
+        refs.push_back( ( int )planes.size() << 2 | PLANE );
+        planes.push_back( p );
+    }
+    else if( Triangle* triangle = dynamic_cast< Triangle* >( obj ) )
+    {
+        TriangleData t;
+        t.v0 = triangle->getVertex( 0 );
+        t.e1 = triangle->getVertex( 1 ) - t.v0;
+        t.e2 = triangle->getVertex( 2 ) - t.v0;
+        TriangleShading shading;
+        for( int k = 0; k < 3; k++ )
+        {
+            shading.normals[k] = triangle->normals[k];
+            shading.texCoords[k] = triangle->texCoords[k];
+        }
+        shading.hasTex = triangle->hasTex;
+        refs.push_back( ( int )triangles.size() << 2 | TRIANGLE );
+        triangles.push_back( t );
+        triangleShading.push_back( shading );
+    }
+    else
+    {
+        refs.push_back( ( int )objects.size() << 2 | OBJECT );
+        objects.push_back( obj );
+    }
+}
+
+bool PrimitiveSet::getBounds( int i, BBox& box ) const
+{
+    int index = refs[i] >> 2;
+    switch( refs[i] & 3 )
+    {
+    case SPHERE:
+    {
+        const SphereData& s = spheres[ index ];
+        Vector3f r( s.radius, s.radius, s.radius );
+        box = BBox( s.center - r, s.center + r );
+        return true;
+    }
+    case PLANE:
+        return false;
+    case TRIANGLE:
+    {
+        const TriangleData& t = triangles[ index ];
+        box = BBox();
+        box.extend( t.v0 );
+        box.extend( t.v0 + t.e1 );
+        box.extend( t.v0 + t.e2 );
+        return true;
+    }
+    default:
+        return objects[ index ]->getBounds( box );
+    }
+}
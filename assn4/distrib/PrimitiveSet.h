@@ -0,0 +1,265 @@
+#ifndef PRIMITIVE_SET_H
+#define PRIMITIVE_SET_H
+
+#include <vector>
+#include "Object3D.h"
+#include "Sphere.h"
+#include "Plane.h"
+#include "Triangle.h"
+
+// data the intersection tests read, kept apart from the shading data so
+// the arrays stay small
+struct SphereData
+{
+    Vector3f center;
+    float radius;
+};
+
+struct PlaneData
+{
+    Vector3f normal;
+    float d;
+};
+
+struct TriangleData
+{
+    Vector3f v0, e1, e2;
+};
+
+// only read by getAttributes, for the closest hit
+struct TriangleShading
+{
+    Vector3f normals[3];
+    Vector2f texCoords[3];
+    bool hasTex;
+};
+
+///Flattened copy of a list of scene objects.
+///Spheres, planes and triangles are copied into contiguous arrays of
+///their type and intersected by a switch on a type tag, with no virtual
+///call and no pointer to chase. Any other object (transforms, meshes,
+///nested groups) is kept as an Object3D* and called virtually.
+///
+///Entry i of the set refers to one primitive; the Object3D classes
+///remain the authoring interface, the set is rebuilt from them.
+class PrimitiveSet
+{
+public:
+
+    enum Type
+    {
+        SPHERE, PLANE, TRIANGLE, OBJECT
+    };
+
+    PrimitiveSet() {}
+
+    void clear();
+
+    ///copies obj into the array of its type and appends an entry for it;
+    ///the object must outlive the set only if it is of type OBJECT
+    void add( Object3D* obj );
+
+    int size() const
+    {
+        return ( int )refs.size();
+    }
+
+    ///closest hit test of entry i, h.getT() is the current closest distance
+    bool intersect( int i, const Ray& r, Hit& h, float tmin ) const
+    {
+        int index = refs[i] >> 2;
+        float t, beta, gamma;
+        switch( refs[i] & 3 )
+        {
+        case SPHERE:
+            if( !Sphere::intersectSphere( r, spheres[ index ].center, spheres[ index ].radius, tmin, h.getT(), t ) )
+            {
+                return false;
+            }
+            h.record( t );
+            return true;
+        case PLANE:
+            if( !Plane::intersectPlane( r, planes[ index ].normal, planes[ index ].d, tmin, h.getT(), t ) )
+            {
+                return false;
+            }
+            h.record( t );
+            return true;
+        case TRIANGLE:
+        {
+            const TriangleData& tri = triangles[ index ];
+            if( !Triangle::intersectTriangle( r, tri.v0, tri.e1, tri.e2, tmin, h.getT(), t, beta, gamma ) )
+            {
+                return false;
+            }
+            h.record( t, -1, beta, gamma );
+            return true;
+        }
+        default:
+            return objects[ index ]->intersect( r, h, tmin );
+        }
+    }
+
+    ///attributes of a hit recorded by intersect( i, ... )
+    void getAttributes( int i, const Ray& r, Hit& h ) const
+    {
+        int index = refs[i] >> 2;
+        switch( refs[i] & 3 )
+        {
+        case SPHERE:
+            h.set( h.getT(), materials[i], ( r.pointAtParameter( h.getT() ) - spheres[ index ].center ).normalized() );
+            break;
+        case PLANE:
+            h.set( h.getT(), materials[i], planes[ index ].normal );
+            break;
+        case TRIANGLE:
+            setTriangleAttributes( index, materials[i], h );
+            break;
+        default:
+            objects[ index ]->getAttributes( r, h );
+            break;
+        }
+    }
+
+    ///any-hit test of entry i
+    bool occluded( int i, const Ray& r, float tmin, float tmax ) const
+    {
+        int index = refs[i] >> 2;
+        float t, beta, gamma;
+        switch( refs[i] & 3 )
+        {
+        case SPHERE:
+            return Sphere::intersectSphere( r, spheres[ index ].center, spheres[ index ].radius, tmin, tmax, t );
+        case PLANE:
+            return Plane::intersectPlane( r, planes[ index ].normal, planes[ index ].d, tmin, tmax, t );
+        case TRIANGLE:
+        {
+            const TriangleData& tri = triangles[ index ];
+            return Triangle::intersectTriangle( r, tri.v0, tri.e1, tri.e2, tmin, tmax, t, beta, gamma );
+        }
+        default:
+            return objects[ index ]->occluded( r, tmin, tmax );
+        }
+    }
+
+    ///any-hit test of entry i that records what blocked the ray in o
+    bool findOccluder( int i, const Ray& r, float tmin, float tmax, Occluder& o ) const
+    {
+        if( ( refs[i] & 3 ) == OBJECT )
+        {
+            return objects[ refs[i] >> 2 ]->findOccluder( r, tmin, tmax, o );
+        }
+        if( !occluded( i, r, tmin, tmax ) )
+        {
+            return false;
+        }
+        o.record();
+        return true;
+    }
+
+    ///any-hit test of what findOccluder( i, ... ) recorded in o
+    bool occludedBy( int i, const Ray& r, float tmin, float tmax, const Occluder& o, int level ) const
+    {
+        if( ( refs[i] & 3 ) == OBJECT )
+        {
+            return objects[ refs[i] >> 2 ]->occludedBy( r, tmin, tmax, o, level );
+        }
+        return occluded( i, r, tmin, tmax );
+    }
+
+#ifdef RT_USE_SSE
+    ///packet test of entry i
+    ///@return bit j is set if h[j] was updated
+    int intersectPacket( int i, const RayPacket& p, HitPacket& h, float tmin ) const
+    {
+        int index = refs[i] >> 2;
+        __m128 t, beta, gamma;
+        int mask;
+        switch( refs[i] & 3 )
+        {
+        case SPHERE:
+            mask = Sphere::intersectSphere( p, spheres[ index ].center, spheres[ index ].radius,
+                _mm_set1_ps( tmin ), h.getT(), t );
+            break;
+        case PLANE:
+            mask = Plane::intersectPlane( p, planes[ index ].normal, planes[ index ].d,
+                _mm_set1_ps( tmin ), h.getT(), t );
+            break;
+        case TRIANGLE:
+        {
+            const TriangleData& tri = triangles[ index ];
+            mask = Triangle::intersectTriangle( p, tri.v0, tri.e1, tri.e2,
+                _mm_set1_ps( tmin ), h.getT(), t, beta, gamma );
+            break;
+        }
+        default:
+            return objects[ index ]->intersectPacket( p, h, tmin );
+        }
+        if( !mask )
+        {
+            return 0;
+        }
+
+        float ts[4], bs[4], gs[4];
+        _mm_storeu_ps( ts, t );
+        if( ( refs[i] & 3 ) == TRIANGLE )
+        {
+            _mm_storeu_ps( bs, beta );
+            _mm_storeu_ps( gs, gamma );
+        }
+        for( int j = 0; j < PACKET_SIZE; j++ )
+        {
+            if( !( mask & ( 1 << j ) ) )
+            {
+                continue;
+            }
+            if( ( refs[i] & 3 ) == TRIANGLE )
+            {
+                h[j].record( ts[j], -1, bs[j], gs[j] );
+            }
+            else
+            {
+                h[j].record( ts[j] );
+            }
+        }
+        return mask;
+    }
+#endif
+
+    ///@return false if entry i is unbounded
+    bool getBounds( int i, BBox& box ) const;
+
+private:
+
+    void setTriangleAttributes( int index, Material* m, Hit& h ) const
+    {
+        const TriangleData& tri = triangles[ index ];
+        const TriangleShading& shading = triangleShading[ index ];
+        float beta = h.getBeta(), gamma = h.getGamma();
+        float alpha = 1 - beta - gamma;
+        Vector3f normal = alpha * shading.normals[0] + beta * shading.normals[1] + gamma * shading.normals[2];
+        if( normal.absSquared() == 0 )
+        {
+            // no vertex normals, use the face normal
+            normal = Vector3f::cross( tri.e1, tri.e2 );
+        }
+        h.set( h.getT(), m, normal.normalized() );
+        if( shading.hasTex )
+        {
+            h.setTexCoord( alpha * shading.texCoords[0] + beta * shading.texCoords[1] + gamma * shading.texCoords[2],
+                Triangle::texScale( shading.texCoords, tri.e1, tri.e2 ) );
+        }
+    }
+
+    // entry i: index into the array of its type << 2 | type
+    std::vector< int > refs;
+    std::vector< Material* > materials;
+
+    std::vector< SphereData > spheres;
+    std::vector< PlaneData > planes;
+    std::vector< TriangleData > triangles;
+    std::vector< TriangleShading > triangleShading;
+    std::vector< Object3D* > objects;
+};
+
+#endif // PRIMITIVE_SET_H
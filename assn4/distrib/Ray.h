@@ -2,26 +2,42 @@
 #define RAY_H
 
 #include <cassert>
+#include <cfloat>
 #include <iostream>
 #include <Vector3f.h>
 
 using namespace std;
 
-// Ray class mostly copied from Peter Shirley and Keith Morley
+// Ray class mostly copied from Peter Shirley and Keith Morley.
+// Also holds what every box test needs, computed once per ray: the
+// reciprocal direction and the sign of each component.
 class Ray
 {
 public:
 
-    Ray( const Vector3f& orig, const Vector3f& dir )
+    ///@param tmax far end of the ray; hits beyond it are ignored
+    Ray( const Vector3f& orig, const Vector3f& dir, float tmax = FLT_MAX )
     {
         origin = orig; 
         direction = dir;
+        this->tmax = tmax;
+        for( int k = 0; k < 3; k++ )
+        {
+            invDirection[k] = 1.0f / dir[k];
+            sign[k] = invDirection[k] < 0;
+        }
     }
 
     Ray( const Ray& r )
     { 
         origin = r.origin;
         direction = r.direction;
+        tmax = r.tmax;
+        for( int k = 0; k < 3; k++ )
+        {
+            invDirection[k] = r.invDirection[k];
+            sign[k] = r.sign[k];
+        }
     }
 
     const Vector3f& getOrigin() const
@@ -34,6 +50,24 @@ public:
         return direction;
     }
     
+    ///1 / direction per component, +-inf along axis parallel directions
+    const float* getInvDirection() const
+    {
+        return invDirection;
+    }
+
+    ///1 if the direction is negative along axis k: the box plane the ray
+    ///enters through is then the max one
+    int getSign( int k ) const
+    {
+        return sign[k];
+    }
+
+    float getTMax() const
+    {
+        return tmax;
+    }
+
     Vector3f pointAtParameter( float t ) const
     {
         return origin + direction * t;
@@ -49,6 +83,10 @@ private:
 
     Vector3f origin;
     Vector3f direction;
+    // plain floats, they are read in the inner loop of the traversals
+    float invDirection[3];
+    int sign[3];
+    float tmax;
 
 };
 
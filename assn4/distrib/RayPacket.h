@@ -0,0 +1,99 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "Ray.h"
+#include "Hit.h"
+
+// SSE2 is part of every x86-64 target; without it packets are traced
+// one ray at a time through Object3D::intersectPacket.
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define RT_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+#define PACKET_SIZE 4
+
+///Four rays traced together, stored both as Rays and in SoA form.
+///Built for coherent primary rays such as a 2x2 pixel block.
+class RayPacket
+{
+public:
+
+    ///@param r array of PACKET_SIZE rays, must outlive the packet
+    RayPacket( const Ray* r ) : rays( r )
+    {
+        coherent = true;
+        for( int i = 0; i < PACKET_SIZE; i++ )
+        {
+            for( int k = 0; k < 3; k++ )
+            {
+                if( r[i].getSign( k ) != r[0].getSign( k ) )
+                {
+                    coherent = false;
+                }
+            }
+        }
+#ifdef RT_USE_SSE
+        for( int k = 0; k < 3; k++ )
+        {
+            o[k] = _mm_setr_ps( r[0].getOrigin()[k], r[1].getOrigin()[k],
+                                r[2].getOrigin()[k], r[3].getOrigin()[k] );
+            d[k] = _mm_setr_ps( r[0].getDirection()[k], r[1].getDirection()[k],
+                                r[2].getDirection()[k], r[3].getDirection()[k] );
+            invD[k] = _mm_setr_ps( r[0].getInvDirection()[k], r[1].getInvDirection()[k],
+                                   r[2].getInvDirection()[k], r[3].getInvDirection()[k] );
+        }
+#endif
+    }
+
+    const Ray& getRay( int i ) const
+    {
+        return rays[i];
+    }
+
+    ///true if all directions lie in the same octant, so a single
+    ///front-to-back order is valid for the whole packet
+    bool isCoherent() const
+    {
+        return coherent;
+    }
+
+#ifdef RT_USE_SSE
+    __m128 o[3];
+    __m128 d[3];
+    __m128 invD[3];
+#endif
+
+private:
+
+    const Ray* rays;
+    bool coherent;
+
+};
+
+///closest hits of a packet, one Hit per ray
+class HitPacket
+{
+public:
+
+    HitPacket( Hit* h ) : hits( h ) {}
+
+    Hit& operator [] ( int i )
+    {
+        return hits[i];
+    }
+
+#ifdef RT_USE_SSE
+    __m128 getT() const
+    {
+        return _mm_setr_ps( hits[0].getT(), hits[1].getT(), hits[2].getT(), hits[3].getT() );
+    }
+#endif
+
+private:
+
+    Hit* hits;
+
+};
+
+#endif // RAY_PACKET_H
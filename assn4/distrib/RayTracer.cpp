@@ -0,0 +1,268 @@
+#include "RayTracer.h"
+#include "SceneParser.h"
+#include "Light.h"
+#include "Material.h"
+#include "Group.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+// streams of RayTracer::raySample
+#define ROULETTE_STREAM 0
+#define LIGHT_STREAM 1
+
+RayTracer::RayTracer( SceneParser* scene, bool shadows ) :
+    scene( scene ), shadows( shadows ), pixelSize( 0 ), maxDepth( RAY_MAX_DEPTH ),
+    lightSamples( LIGHT_SAMPLES )
+{
+    group = scene->getGroup();
+    std::vector< Light* > pointLights;
+    for( int i = 0; i < scene->getNumLights(); i++ )
+    {
+        Vector3f position;
+        if( scene->getLight( i )->getPosition( position ) )
+        {
+            pointLights.push_back( scene->getLight( i ) );
+        }
+        else
+        {
+            directionalLights.push_back( scene->getLight( i ) );
+        }
+    }
+    lightTree.build( pointLights );
+}
+
+RayTracer::~RayTracer()
+{
+
+}
+
+// the ray's tmax bounds the search; from there on hit.getT() holds the
+// far end of the interval and shrinks with every closer hit found
+Vector3f RayTracer::traceRay( const Ray& ray, float tmin, Hit& hit, const PathState& path ) const
+{
+    if( ray.getTMax() < hit.getT() )
+    {
+        hit.set( ray.getTMax(), NULL, hit.getNormal() );
+    }
+    HitPath childPath;
+    hit.setPath( &childPath );
+    bool found = group != NULL && group->intersect( ray, hit, tmin );
+    if( found )
+    {
+        group->getAttributes( ray, hit );
+    }
+    hit.setPath( NULL );
+    if( !found )
+    {
+        return scene->getBackgroundColor();
+    }
+    setFootprint( ray, hit );
+    return shade( ray, hit, path );
+}
+
+void RayTracer::tracePacket( const Ray* rays, float tmin, Hit* hits, Vector3f* colors, RayBudget* budget,
+                             ShadowCache* shadowCache ) const
+{
+    int mask = 0;
+    HitPath childPaths[ PACKET_SIZE ];
+    for( int i = 0; i < PACKET_SIZE; i++ )
+    {
+        if( rays[i].getTMax() < hits[i].getT() )
+        {
+            hits[i].set( rays[i].getTMax(), NULL, hits[i].getNormal() );
+        }
+        hits[i].setPath( &childPaths[i] );
+    }
+    if( group != NULL )
+    {
+        RayPacket packet( rays );
+        HitPacket hitPacket( hits );
+        mask = group->intersectPacket( packet, hitPacket, tmin );
+    }
+    for( int i = 0; i < PACKET_SIZE; i++ )
+    {
+        if( budget != NULL )
+        {
+            budget->beginPixel();
+        }
+        if( mask & ( 1 << i ) )
+        {
+            group->getAttributes( rays[i], hits[i] );
+            hits[i].setPath( NULL );
+            setFootprint( rays[i], hits[i] );
+            colors[i] = shade( rays[i], hits[i], PathState( 0, Vector3f( 1, 1, 1 ), budget, shadowCache ) );
+        }
+        else
+        {
+            hits[i].setPath( NULL );
+            colors[i] = scene->getBackgroundColor();
+        }
+    }
+}
+
+// camera rays are not normalized: at parameter t neighbouring pixel rays
+// are t * pixelSize apart, whatever the length of the direction
+void RayTracer::setFootprint( const Ray& ray, Hit& hit ) const
+{
+    if( !hit.hasTexCoord() || hit.getTexScale() <= 0 )
+    {
+        hit.setTexFootprint( 0 );
+        return;
+    }
+    // grazing angles stretch the footprint, capped so it stays finite
+    float cosine = fabs( Vector3f::dot( ray.getDirection().normalized(), hit.getNormal() ) );
+    if( cosine < 0.05f )
+    {
+        cosine = 0.05f;
+    }
+    hit.setTexFootprint( hit.getT() * pixelSize * hit.getTexScale() / cosine );
+}
+
+Vector3f RayTracer::shade( const Ray& ray, const Hit& hit, const PathState& path ) const
+{
+    Material* material = hit.getMaterial();
+    Vector3f color = scene->getAmbientLight() * material->getDiffuseColor( hit );
+
+    Vector3f p = ray.pointAtParameter( hit.getT() );
+    forLights( ray, hit, p, [&]( const Light* light, const Vector3f& dirToLight, const Vector3f& lightColor,
+                                 float distanceToLight ) {
+        if( shadows && occluded( Ray( p, dirToLight, distanceToLight ), light, path.shadowCache ) )
+        {
+            return;
+        }
+        color += material->Shade( ray, hit, dirToLight, lightColor );
+    } );
+
+    forSecondaryRays( ray, hit, path, [&]( const Ray& secondary, const Vector3f& weight ) {
+        Hit secondaryHit;
+        PathState next( path.depth + 1, path.throughput * weight, path.budget, path.shadowCache );
+        color += weight * traceRay( secondary, SURFACE_EPSILON, secondaryHit, next );
+    } );
+    return color;
+}
+
+// few lights are all shaded in scene order; past lightSamples the
+// directional lights come first, then the picks from the light tree
+int RayTracer::getNumLightSamples() const
+{
+    if( lightSamples <= 0 || lightTree.size() <= lightSamples )
+    {
+        return scene->getNumLights();
+    }
+    return ( int )directionalLights.size() + lightSamples;
+}
+
+bool RayTracer::getLightSample( const Ray& ray, const Hit& hit, const Vector3f& p, int s, Light*& light,
+                                Vector3f& dirToLight, Vector3f& lightColor, float& distanceToLight ) const
+{
+    if( lightSamples <= 0 || lightTree.size() <= lightSamples )
+    {
+        light = scene->getLight( s );
+        light->getIllumination( p, dirToLight, lightColor, distanceToLight );
+        return true;
+    }
+    if( s < ( int )directionalLights.size() )
+    {
+        light = directionalLights[s];
+        light->getIllumination( p, dirToLight, lightColor, distanceToLight );
+        return true;
+    }
+    // pick k gets a random u in [k / lightSamples, (k + 1) / lightSamples):
+    // the picks spread over the tree instead of repeating the brightest light
+    int k = s - ( int )directionalLights.size();
+    float u = ( k + raySample( ray, LIGHT_STREAM + k ) ) / lightSamples;
+    float pdf;
+    light = lightTree.sample( p, hit.getNormal().normalized(), std::min( u, 0.99999994f ), pdf );
+    if( light == NULL )
+    {
+        return false;
+    }
+    light->getIllumination( p, dirToLight, lightColor, distanceToLight );
+    lightColor = lightColor / ( pdf * lightSamples );
+    return true;
+}
+
+bool RayTracer::occluded( const Ray& shadowRay, const Light* light, ShadowCache* cache ) const
+{
+    if( cache == NULL )
+    {
+        return group->occluded( shadowRay, SURFACE_EPSILON, shadowRay.getTMax() );
+    }
+    return cache->occluded( group, light, shadowRay, SURFACE_EPSILON, shadowRay.getTMax() );
+}
+
+bool RayTracer::continuePath( const Ray& secondary, const PathState& path, Vector3f& weight ) const
+{
+    if( path.depth >= maxDepth )
+    {
+        return false;
+    }
+    Vector3f throughput = path.throughput * weight;
+    float largest = std::max( throughput[0], std::max( throughput[1], throughput[2] ) );
+    if( largest < RAY_MIN_THROUGHPUT )
+    {
+        return false;
+    }
+    // keep the ray with a probability that follows its throughput, then
+    // boost it by the inverse so the expected color stays the same
+    float survival = largest / ROULETTE_THROUGHPUT;
+    if( path.depth + 1 >= ROULETTE_DEPTH && survival < 1 )
+    {
+        if( raySample( secondary, ROULETTE_STREAM ) >= survival )
+        {
+            return false;
+        }
+        weight = weight / survival;
+    }
+    return path.budget == NULL || path.budget->take();
+}
+
+Vector3f RayTracer::reflect( const Vector3f& d, const Vector3f& n )
+{
+    return d - 2 * Vector3f::dot( d, n ) * n;
+}
+
+bool RayTracer::refract( const Vector3f& d, const Vector3f& n, float eta, Vector3f& refracted )
+{
+    float cosine = -Vector3f::dot( d, n );
+    Vector3f normal = n;
+    float ratio = 1 / eta;
+    if( cosine < 0 )
+    {
+        // leaving the object
+        cosine = -cosine;
+        normal = -n;
+        ratio = eta;
+    }
+    float k = 1 - ratio * ratio * ( 1 - cosine * cosine );
+    if( k < 0 )
+    {
+        return false;
+    }
+    refracted = ratio * d + ( ratio * cosine - sqrt( k ) ) * normal;
+    return true;
+}
+
+float RayTracer::raySample( const Ray& r, unsigned int stream )
+{
+    uint32_t h = 2166136261u ^ stream;
+    for( int k = 0; k < 3; k++ )
+    {
+        uint32_t bits[2];
+        memcpy( &bits[0], &r.getOrigin()[k], sizeof( float ) );
+        memcpy( &bits[1], &r.getDirection()[k], sizeof( float ) );
+        for( int j = 0; j < 2; j++ )
+        {
+            // murmur3 finalizer
+            h ^= bits[j];
+            h ^= h >> 16;
+            h *= 0x85ebca6bu;
+            h ^= h >> 13;
+            h *= 0xc2b2ae35u;
+            h ^= h >> 16;
+        }
+    }
+    return ( h >> 8 ) * ( 1.0f / 16777216 );
+}
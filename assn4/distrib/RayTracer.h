@@ -0,0 +1,246 @@
+#ifndef RAY_TRACER_H
+#define RAY_TRACER_H
+
+#include <vector>
+#include <vecmath.h>
+#include "Ray.h"
+#include "Hit.h"
+#include "RayPacket.h"
+#include "Material.h"
+#include "LightBVH.h"
+#include "ShadowCache.h"
+
+class SceneParser;
+class Group;
+class Light;
+
+// offset along rays leaving a surface (shadow, reflected and refracted
+// rays) so the surface does not hit itself
+#define SURFACE_EPSILON 1e-4f
+// default for setMaxDepth
+#define RAY_MAX_DEPTH 4
+// paths whose color reaches the pixel scaled by less than this stop,
+// below what one step of an 8 bit channel shows
+#define RAY_MIN_THROUGHPUT ( 1.0f / 256 )
+// secondary rays from this depth on whose throughput is below
+// ROULETTE_THROUGHPUT go through Russian roulette. Paths that still add
+// a large part of the pixel are never cut, which keeps the noise of one
+// sample per pixel down to the faint ones.
+#define ROULETTE_DEPTH 2
+#define ROULETTE_THROUGHPUT 0.1f
+// default for setLightSamples
+#define LIGHT_SAMPLES 8
+
+///Secondary rays a tile may still spawn. Once they are spent, the
+///remaining hits are shaded without reflection or refraction, which
+///bounds the time a mirror-heavy tile takes. One per tile, so it is
+///only used by one thread.
+class RayBudget
+{
+public:
+
+    ///@param rays number of rays, negative for no limit
+    ///@param pixels pixels of the tile, for beginPixel
+    RayBudget( int rays = -1, int pixels = 1 ) :
+        remaining( rays ), share( rays ), pixelsLeft( pixels ) {}
+
+    ///Call before tracing each pixel when pixels are traced one after the
+    ///other. The pixel may use its even share of the rays left, plus what
+    ///earlier pixels left unused, so the first pixels of a tile cannot
+    ///spend the whole budget on deep paths. Without it the whole budget
+    ///goes to whichever rays ask first.
+    void beginPixel()
+    {
+        if( remaining >= 0 && pixelsLeft > 0 )
+        {
+            share = ( remaining + pixelsLeft - 1 ) / pixelsLeft;
+            pixelsLeft--;
+        }
+    }
+
+    ///@return false if the budget is spent, else counts one ray
+    bool take()
+    {
+        if( remaining < 0 )
+        {
+            return true;
+        }
+        if( remaining == 0 || share == 0 )
+        {
+            return false;
+        }
+        remaining--;
+        share--;
+        return true;
+    }
+
+private:
+
+    int remaining;
+    int share;
+    int pixelsLeft;
+
+};
+
+///where a ray is on its path from the camera
+struct PathState
+{
+    PathState( int depth = 0, const Vector3f& throughput = Vector3f( 1, 1, 1 ), RayBudget* budget = NULL,
+               ShadowCache* shadowCache = NULL ) :
+        depth( depth ), throughput( throughput ), budget( budget ), shadowCache( shadowCache ) {}
+
+    ///bounces before this ray, 0 for camera rays
+    int depth;
+    ///fraction of the ray's color that reaches the pixel
+    Vector3f throughput;
+    ///NULL for no limit
+    RayBudget* budget;
+    ///the calling thread's, NULL to trace every shadow ray in full
+    ShadowCache* shadowCache;
+};
+
+///Computes the color seen along a ray.
+///Holds no per-ray state, so one tracer is shared by all render threads.
+class RayTracer
+{
+public:
+
+    ///@param shadows cast a shadow ray toward every light at each hit
+    RayTracer( SceneParser* scene, bool shadows = false );
+    ~RayTracer();
+
+    ///distance between neighbouring pixels on the camera's image plane,
+    ///used to pick texture mip levels; 0 disables filtering
+    void setPixelSize( float size )
+    {
+        pixelSize = size;
+    }
+
+    ///bounces followed after the camera ray at most
+    void setMaxDepth( int depth )
+    {
+        maxDepth = depth;
+    }
+
+    ///Scenes with more lights than this shade every hit with this many
+    ///lights picked from a LightBVH, plus every directional light.
+    ///0 shades every light at every hit.
+    void setLightSamples( int samples )
+    {
+        lightSamples = samples;
+    }
+
+    ///@param path depth and throughput of the ray, the defaults for a camera ray
+    Vector3f traceRay( const Ray& ray, float tmin, Hit& hit, const PathState& path = PathState() ) const;
+
+    ///traces PACKET_SIZE coherent camera rays together and writes one color per ray
+    void tracePacket( const Ray* rays, float tmin, Hit* hits, Vector3f* colors, RayBudget* budget = NULL,
+                      ShadowCache* shadowCache = NULL ) const;
+
+private:
+
+    // the wavefront mode runs the same stages over batches of rays
+    friend class Wavefront;
+
+    ///direct light at the hit plus what its reflection and refraction see
+    Vector3f shade( const Ray& ray, const Hit& hit, const PathState& path ) const;
+    void setFootprint( const Ray& ray, Hit& hit ) const;
+
+    ///calls light( source, dirToLight, lightColor, distanceToLight ) for the
+    ///lights that shade the hit at p. The sum of what they add has the
+    ///expected value of shading with every light: picked lights have
+    ///their color divided by the number of picks and the probability of
+    ///the pick.
+    template< class LightFn >
+    void forLights( const Ray& ray, const Hit& hit, const Vector3f& p, LightFn light ) const
+    {
+        int n = getNumLightSamples();
+        for( int s = 0; s < n; s++ )
+        {
+            Light* source;
+            Vector3f dirToLight, lightColor;
+            float distanceToLight;
+            if( getLightSample( ray, hit, p, s, source, dirToLight, lightColor, distanceToLight ) )
+            {
+                light( source, dirToLight, lightColor, distanceToLight );
+            }
+        }
+    }
+
+    int getNumLightSamples() const;
+    ///@return false if sample s found no light in front of the surface
+    bool getLightSample( const Ray& ray, const Hit& hit, const Vector3f& p, int s, Light*& light,
+                         Vector3f& dirToLight, Vector3f& lightColor, float& distanceToLight ) const;
+    ///shadow test of shadowRay toward light, through cache if not NULL
+    bool occluded( const Ray& shadowRay, const Light* light, ShadowCache* cache ) const;
+
+    ///calls spawn( secondary, weight ) for the reflected and the refracted
+    ///ray of a hit that are worth following; the color seen along
+    ///secondary adds to the hit's color times weight
+    template< class Spawn >
+    void forSecondaryRays( const Ray& ray, const Hit& hit, const PathState& path, Spawn spawn ) const
+    {
+        if( path.depth >= maxDepth )
+        {
+            return;
+        }
+        Material* material = hit.getMaterial();
+        Vector3f reflective = material->getReflectiveColor();
+        const Vector3f& transparent = material->getTransparentColor();
+        Vector3f d = ray.getDirection().normalized();
+        Vector3f p = ray.pointAtParameter( hit.getT() );
+        Vector3f refracted;
+        bool refracts = transparent.absSquared() > 0;
+        if( refracts && !refract( d, hit.getNormal(), material->getIndexOfRefraction(), refracted ) )
+        {
+            // total internal reflection, the transmitted light is reflected
+            reflective += transparent;
+            refracts = false;
+        }
+        if( reflective.absSquared() > 0 )
+        {
+            Ray secondary( p, reflect( d, hit.getNormal() ) );
+            Vector3f weight = reflective;
+            if( continuePath( secondary, path, weight ) )
+            {
+                spawn( secondary, weight );
+            }
+        }
+        if( refracts )
+        {
+            Ray secondary( p, refracted );
+            Vector3f weight = transparent;
+            if( continuePath( secondary, path, weight ) )
+            {
+                spawn( secondary, weight );
+            }
+        }
+    }
+
+    ///depth limit, throughput threshold, Russian roulette and budget:
+    ///@return false to drop secondary, else weight is rescaled so the
+    ///rays the roulette keeps make up for the ones it drops
+    bool continuePath( const Ray& secondary, const PathState& path, Vector3f& weight ) const;
+
+    ///@param d n unit direction and surface normal
+    static Vector3f reflect( const Vector3f& d, const Vector3f& n );
+    ///@param eta index of refraction inside the surface, the side n points away from
+    ///@return false on total internal reflection
+    static bool refract( const Vector3f& d, const Vector3f& n, float eta, Vector3f& refracted );
+    ///uniform in [0, 1), a hash of the ray and stream, so a decision made
+    ///with it is the same whatever thread, tile or render mode traces the ray
+    static float raySample( const Ray& r, unsigned int stream );
+
+    SceneParser* scene;
+    Group* group;
+    bool shadows;
+    float pixelSize;
+    int maxDepth;
+    int lightSamples;
+    // the lights with a position are in the tree, the others are always shaded
+    LightBVH lightTree;
+    std::vector< Light* > directionalLights;
+
+};
+
+#endif // RAY_TRACER_H
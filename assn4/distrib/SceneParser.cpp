@@ -1,6 +1,9 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <cctype>
+#include <cstdarg>
+#include <charconv>
 #define _USE_MATH_DEFINES
 #include <cmath>
 
@@ -15,6 +18,7 @@
 #include "Plane.h"
 #include "Triangle.h"
 #include "Transform.h"
+#include "MappedFile.h"
 
 #define DegreesToRadians(x) ((3.1415926f * x) / 180.0f)
 
@@ -30,24 +34,29 @@ SceneParser::SceneParser(const char* filename) {
     num_materials = 0;
     materials = NULL;
     current_material = NULL;
+    bvhQuality = BVH::SAH;
+    groupDepth = 0;
 
     // parse the file
     assert(filename != NULL);
     const char *ext = &filename[strlen(filename)-4];
 
     if(strcmp(ext,".txt")!=0){
-		printf("wrong file name extension\n");
-		exit(0);
+		fprintf(stderr, "wrong file name extension\n");
+		exit(1);
 	}
-    file = fopen(filename,"r");
-
-	if (file == NULL){
-		printf("cannot open scene file\n");
-		exit(0);
+    // the whole file is tokenized in memory, tokens point into it
+    MappedFile file(filename);
+	if (file.data == NULL){
+		fprintf(stderr, "cannot open scene file\n");
+		exit(1);
 	}
+    this->filename = filename;
+    cursor = file.data;
+    end = file.data + file.size;
+    line = 1;
     parseFile();
-    fclose(file); 
-    file = NULL;
+    cursor = end = NULL;
 
     // if no lights are specified, set ambient light to white
     // (do solid color ray casting)
@@ -58,17 +67,8 @@ SceneParser::SceneParser(const char* filename) {
 }
 
 SceneParser::~SceneParser() {
-    if (group != NULL) 
-        delete group;
-    if (camera != NULL) 
-        delete camera;
-    int i;
-    for (i = 0; i < num_materials; i++) {
-        delete materials[i]; }
-    delete [] materials;
-    for (i = 0; i < num_lights; i++) {
-        delete lights[i]; }
-    delete [] lights;
+    // camera, lights, materials, meshes and the whole object tree
+    // live in the arena and go away with it
 }
 
 // ====================================================================
@@ -80,21 +80,22 @@ void SceneParser::parseFile() {
     // background color and a group of objects
     // (we add lights and other things in future assignments)
     //
-    char token[MAX_PARSER_TOKEN_LENGTH];        
+    std::string_view token;        
     while (getToken(token)) { 
-        if (!strcmp(token, "PerspectiveCamera")) {
+        if (token == "PerspectiveCamera") {
             parsePerspectiveCamera();
-        } else if (!strcmp(token, "Background")) {
+        } else if (token == "Background") {
             parseBackground();
-        } else if (!strcmp(token, "Lights")) {
+        } else if (token == "Lights") {
             parseLights();
-        } else if (!strcmp(token, "Materials")) {
+        } else if (token == "Materials") {
             parseMaterials();
-        } else if (!strcmp(token, "Group")) {
+        } else if (token == "Accelerator") {
+            parseAccelerator();
+        } else if (token == "Group") {
             group = parseGroup();
         } else {
-            printf ("Unknown token in parseFile: '%s'\n", token);
-            exit(0);
+            parseError("Unknown token in parseFile: '%.*s'", (int)token.size(), token.data());
         }
     }
 }
@@ -103,37 +104,35 @@ void SceneParser::parseFile() {
 // ====================================================================
 
 void SceneParser::parsePerspectiveCamera() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
     // read in the camera parameters
-    getToken(token); assert (!strcmp(token, "{"));
-    getToken(token); assert (!strcmp(token, "center"));
+    expectToken("{");
+    expectToken("center");
     Vector3f center = readVector3f();
-    getToken(token); assert (!strcmp(token, "direction"));
+    expectToken("direction");
     Vector3f direction = readVector3f();
-    getToken(token); assert (!strcmp(token, "up"));
+    expectToken("up");
     Vector3f up = readVector3f();
-    getToken(token); assert (!strcmp(token, "angle"));
+    expectToken("angle");
     float angle_degrees = readFloat();
     float angle_radians = DegreesToRadians(angle_degrees);
-    getToken(token); assert (!strcmp(token, "}"));
-    camera = new PerspectiveCamera(center,direction,up,angle_radians);
+    expectToken("}");
+    camera = arena.create<PerspectiveCamera>(center,direction,up,angle_radians);
 }
 
 void SceneParser::parseBackground() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
+    std::string_view token;
     // read in the background color
-    getToken(token); assert (!strcmp(token, "{"));    
+    expectToken("{");
     while (1) {
-        getToken(token); 
-        if (!strcmp(token, "}")) { 
+        token = readToken();
+        if (token == "}") { 
             break;    
-        } else if (!strcmp(token, "color")) {
+        } else if (token == "color") {
             background_color = readVector3f();
-        } else if (!strcmp(token, "ambientLight")) {
+        } else if (token == "ambientLight") {
             ambient_light = readVector3f();
         } else {
-            printf ("Unknown token in parseBackground: '%s'\n", token);
-            assert(0);
+            parseError("Unknown token in parseBackground: '%.*s'", (int)token.size(), token.data());
         }
     }
 }
@@ -141,109 +140,151 @@ void SceneParser::parseBackground() {
 // ====================================================================
 // ====================================================================
 
+// Accelerator { build sah|lbvh|treelet|sbvh }
+// picks how the BVHs of the groups and meshes that follow are built;
+// groups build sbvh as sah
+void SceneParser::parseAccelerator() {
+    expectToken("{");
+    expectToken("build");
+    bvhQuality = readBVHQuality();
+    expectToken("}");
+}
+
+BVH::Quality SceneParser::readBVHQuality() {
+    std::string_view token = readToken();
+    if (token == "sah") {
+        return BVH::SAH;
+    } else if (token == "lbvh") {
+        return BVH::LBVH;
+    } else if (token == "treelet") {
+        return BVH::LBVH_TREELET;
+    } else if (token == "sbvh") {
+        return BVH::SBVH;
+    }
+    parseError("Unknown BVH build '%.*s', expected sah, lbvh, treelet or sbvh", (int)token.size(), token.data());
+    return BVH::SAH;
+}
+
+// ====================================================================
+// ====================================================================
+
 void SceneParser::parseLights() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert (!strcmp(token, "{"));
+    std::string_view token;
+    expectToken("{");
     // read in the number of objects
-    getToken(token); assert (!strcmp(token, "numLights"));
+    expectToken("numLights");
     num_lights = readInt();
-    lights = new Light*[num_lights];
+    if (num_lights < 0) {
+        parseError("numLights must not be negative: %d", num_lights);
+    }
+    lights = arena.createArray<Light*>(num_lights);
     // read in the objects
     int count = 0;
     while (num_lights > count) {
-        getToken(token); 
-        if (!strcmp(token, "DirectionalLight")) {
+        token = readToken();
+        if (token == "DirectionalLight") {
             lights[count] = parseDirectionalLight();
-        } else if(strcmp(token, "PointLight")==0)
+        } else if(token == "PointLight")
 		{
 			lights[count] = parsePointLight();
 		}
 		else {
-            printf ("Unknown token in parseLight: '%s'\n", token); 
-            exit(0);    
+            parseError("Unknown token in parseLight: '%.*s'", (int)token.size(), token.data());
         }     
         count++;
     }
-    getToken(token); assert (!strcmp(token, "}"));
+    expectToken("}");
 }
 
 
 Light* SceneParser::parseDirectionalLight() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert (!strcmp(token, "{"));
-    getToken(token); assert (!strcmp(token, "direction"));
+    expectToken("{");
+    expectToken("direction");
     Vector3f direction = readVector3f();
-    getToken(token); assert (!strcmp(token, "color"));
+    expectToken("color");
     Vector3f color = readVector3f();
-    getToken(token); assert (!strcmp(token, "}"));
-    return new DirectionalLight(direction,color);
+    expectToken("}");
+    return arena.create<DirectionalLight>(direction,color);
 }
 Light* SceneParser::parsePointLight() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert (!strcmp(token, "{"));
-    getToken(token); assert (!strcmp(token, "position"));
+    expectToken("{");
+    expectToken("position");
     Vector3f position = readVector3f();
-    getToken(token); assert (!strcmp(token, "color"));
+    expectToken("color");
     Vector3f color = readVector3f();
-    getToken(token); assert (!strcmp(token, "}"));
-    return new PointLight(position,color);
+    expectToken("}");
+    return arena.create<PointLight>(position,color);
 }
 // ====================================================================
 // ====================================================================
 
 void SceneParser::parseMaterials() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert (!strcmp(token, "{"));
+    std::string_view token;
+    expectToken("{");
     // read in the number of objects
-    getToken(token); assert (!strcmp(token, "numMaterials"));
+    expectToken("numMaterials");
     num_materials = readInt();
-    materials = new Material*[num_materials];
+    if (num_materials < 0) {
+        parseError("numMaterials must not be negative: %d", num_materials);
+    }
+    materials = arena.createArray<Material*>(num_materials);
     // read in the objects
     int count = 0;
     while (num_materials > count) {
-        getToken(token); 
-        if (!strcmp(token, "Material") ||
-                !strcmp(token, "PhongMaterial")) {
+        token = readToken();
+        if (token == "Material" ||
+                token == "PhongMaterial") {
             materials[count] = parseMaterial();
         } else {
-            printf ("Unknown token in parseMaterial: '%s'\n", token); 
-            exit(0);
+            parseError("Unknown token in parseMaterial: '%.*s'", (int)token.size(), token.data());
         }
         count++;
     }
-    getToken(token); assert (!strcmp(token, "}"));
+    expectToken("}");
 }    
 
 
 Material* SceneParser::parseMaterial() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-	char filename[MAX_PARSER_TOKEN_LENGTH];
-	filename[0] = 0;
-    Vector3f diffuseColor(1,1,1), specularColor(0,0,0);
-	float shininess=0;
-    getToken(token); assert (!strcmp(token, "{"));
+    std::string_view token;
+	std::string filename;
+    Vector3f diffuseColor(1,1,1), specularColor(0,0,0), reflectiveColor(0,0,0), transparentColor(0,0,0);
+	float shininess=0, indexOfRefraction=1;
+    expectToken("{");
     while (1) {
-        getToken(token); 
-        if (strcmp(token, "diffuseColor")==0) {
+        token = readToken();
+        if (token == "diffuseColor") {
             diffuseColor = readVector3f();
         }
-		else if (strcmp(token, "specularColor")==0) {
+		else if (token == "specularColor") {
             specularColor = readVector3f();
         }
-		else if (strcmp(token, "shininess")==0) {
+		else if (token == "reflectiveColor") {
+            reflectiveColor = readVector3f();
+        }
+		else if (token == "transparentColor") {
+            transparentColor = readVector3f();
+        }
+		else if (token == "indexOfRefraction") {
+            indexOfRefraction = readFloat();
+        }
+		else if (token == "shininess") {
             shininess = readFloat();
         }
-		else if (strcmp(token, "texture")==0) {
-            getToken(filename);
+		else if (token == "texture") {
+            filename = std::string(readToken());
         }
 		else {
-            assert (!strcmp(token, "}"));
+            if (token != "}") {
+                parseError("Unknown token in parseMaterial: '%.*s'", (int)token.size(), token.data());
+            }
             break;
         }
     }
-    Material *answer = new Material(diffuseColor, specularColor, shininess);
-	if(filename[0] !=0){
-		answer->loadTexture(filename);
+    Material *answer = arena.create<Material>(diffuseColor, specularColor, shininess);
+    answer->setReflectiveColor(reflectiveColor);
+    answer->setTransparency(transparentColor, indexOfRefraction);
+	if(!filename.empty()){
+		answer->loadTexture(filename.c_str());
 	}
     return answer;
 }
@@ -251,23 +292,24 @@ Material* SceneParser::parseMaterial() {
 // ====================================================================
 // ====================================================================
 
-Object3D* SceneParser::parseObject(char token[MAX_PARSER_TOKEN_LENGTH]) {
+Object3D* SceneParser::parseObject(std::string_view token) {
     Object3D *answer = NULL;
-    if (!strcmp(token, "Group")) {            
+    if (token == "Group") {            
         answer = (Object3D*)parseGroup();
-    } else if (!strcmp(token, "Sphere")) {            
+    } else if (token == "Sphere") {            
         answer = (Object3D*)parseSphere();
-    } else if (!strcmp(token, "Plane")) {            
+    } else if (token == "Plane") {            
         answer = (Object3D*)parsePlane();
-    } else if (!strcmp(token, "Triangle")) {            
+    } else if (token == "Triangle") {            
         answer = (Object3D*)parseTriangle();
-    } else if (!strcmp(token, "TriangleMesh")) {            
+    } else if (token == "TriangleMesh") {            
         answer = (Object3D*)parseTriangleMesh();
-    } else if (!strcmp(token, "Transform")) {            
+    } else if (token == "SphereSet") {
+        answer = (Object3D*)parseSphereSet();
+    } else if (token == "Transform") {            
         answer = (Object3D*)parseTransform();
     } else {
-        printf ("Unknown token in parseObject: '%s'\n", token);
-        exit(0);
+        parseError("Unknown token in parseObject: '%.*s'", (int)token.size(), token.data());
     }
     return answer;
 }
@@ -284,33 +326,42 @@ Group* SceneParser::parseGroup() {
     // until the next material index (scoping for the materials is very
     // simple, and essentially ignores any tree hierarchy)
     //
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert (!strcmp(token, "{"));
+    std::string_view token;
+    expectToken("{");
+    if (++groupDepth > HIT_MAX_DEPTH) {
+        parseError("Groups nested deeper than %d", HIT_MAX_DEPTH);
+    }
 
     // read in the number of objects
-    getToken(token); assert (!strcmp(token, "numObjects"));
+    expectToken("numObjects");
     int num_objects = readInt();
+    if (num_objects < 0) {
+        parseError("numObjects must not be negative: %d", num_objects);
+    }
 
-    Group *answer = new Group(num_objects);
+    Group *answer = arena.create<Group>(num_objects);
 
     // read in the objects
     int count = 0;
     while (num_objects > count) {
-        getToken(token); 
-        if (!strcmp(token, "MaterialIndex")) {
+        token = readToken();
+        if (token == "MaterialIndex") {
             // change the current material
             int index = readInt();
-            assert (index >= 0 && index <= getNumMaterials());
+            if (index < 0 || index >= getNumMaterials()) {
+                parseError("MaterialIndex %d out of range", index);
+            }
             current_material = getMaterial(index);
         } else {
             Object3D *object = parseObject(token);
-            assert (object != NULL);
             answer->addObject(count,object);
 	    
             count++;
         }
     }
-    getToken(token); assert (!strcmp(token, "}"));
+    expectToken("}");
+    groupDepth--;
+    answer->buildBVH(bvhQuality);
     
     // return the group
     return answer;
@@ -320,106 +371,126 @@ Group* SceneParser::parseGroup() {
 // ====================================================================
 
 Sphere* SceneParser::parseSphere() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert (!strcmp(token, "{"));
-    getToken(token); assert (!strcmp(token, "center"));
+    expectToken("{");
+    expectToken("center");
     Vector3f center = readVector3f();
-    getToken(token); assert (!strcmp(token, "radius"));
+    expectToken("radius");
     float radius = readFloat();
-    getToken(token); assert (!strcmp(token, "}"));
-    assert (current_material != NULL);
-    return new Sphere(center,radius,current_material);
+    expectToken("}");
+    requireMaterial();
+    return arena.create<Sphere>(center,radius,current_material);
 }
 
 
 Plane* SceneParser::parsePlane() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert (!strcmp(token, "{"));
-    getToken(token); assert (!strcmp(token, "normal"));
+    expectToken("{");
+    expectToken("normal");
     Vector3f normal = readVector3f();
-    getToken(token); assert (!strcmp(token, "offset"));
+    expectToken("offset");
     float offset = readFloat();
-    getToken(token); assert (!strcmp(token, "}"));
-    assert (current_material != NULL);
-    return new Plane(normal,offset,current_material);
+    expectToken("}");
+    requireMaterial();
+    return arena.create<Plane>(normal,offset,current_material);
 }
 
 
 Triangle* SceneParser::parseTriangle() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert (!strcmp(token, "{"));
-    getToken(token); 
-    assert (!strcmp(token, "vertex0"));
+    expectToken("{");
+    expectToken("vertex0");
     Vector3f v0 = readVector3f();
-    getToken(token); 
-    assert (!strcmp(token, "vertex1"));
+    expectToken("vertex1");
     Vector3f v1 = readVector3f();
-    getToken(token); 
-    assert (!strcmp(token, "vertex2"));
+    expectToken("vertex2");
     Vector3f v2 = readVector3f();
-    getToken(token); assert (!strcmp(token, "}"));
-    assert (current_material != NULL);
-    return new Triangle(v0,v1,v2,current_material);
+    expectToken("}");
+    requireMaterial();
+    return arena.create<Triangle>(v0,v1,v2,current_material);
 }
 
-Mesh* SceneParser::parseTriangleMesh() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    char filename[MAX_PARSER_TOKEN_LENGTH];
+// TriangleMesh { obj_file name.obj [build sah|lbvh|treelet|sbvh] }
+// the build overrides the Accelerator one for this mesh
+Object3D* SceneParser::parseTriangleMesh() {
     // get the filename
-    getToken(token); assert (!strcmp(token, "{"));
-    getToken(token); assert (!strcmp(token, "obj_file"));
-    getToken(filename); 
-    getToken(token); assert (!strcmp(token, "}"));
-    const char *ext = &filename[strlen(filename)-4];
-    assert(!strcmp(ext,".obj"));
-    Mesh *answer = new Mesh(filename,current_material);
-    
-    return answer;
+    expectToken("{");
+    expectToken("obj_file");
+    std::string filename(readToken());
+    BVH::Quality quality = bvhQuality;
+    std::string_view token = readToken();
+    if (token == "build") {
+        quality = readBVHQuality();
+        token = readToken();
+    }
+    if (token != "}") {
+        parseError("Expected '}' or 'build' but found '%.*s'", (int)token.size(), token.data());
+    }
+    if (filename.size() < 4 || filename.compare(filename.size()-4, 4, ".obj") != 0) {
+        parseError("TriangleMesh needs an .obj file: '%s'", filename.c_str());
+    }
+    requireMaterial();
+
+    // load each file once, every reference becomes a light instance
+    Mesh *&mesh = meshes[std::make_pair(filename, quality)];
+    if (mesh == NULL) {
+        mesh = arena.create<Mesh>(filename.c_str(),(Material*)NULL,quality);
+    }
+    return arena.create<MeshInstance>(mesh,current_material);
+}
+
+
+// SphereSet { file particles.sph }
+// spheres in the binary format of SphereSet, all with the current material
+SphereSet* SceneParser::parseSphereSet() {
+    expectToken("{");
+    expectToken("file");
+    std::string filename(readToken());
+    expectToken("}");
+    requireMaterial();
+    return arena.create<SphereSet>(filename.c_str(),current_material,bvhQuality);
 }
 
 
 Transform* SceneParser::parseTransform() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
+    std::string_view token;
     Matrix4f matrix = Matrix4f::identity();
     Object3D *object = NULL;
-    getToken(token); assert (!strcmp(token, "{"));
+    expectToken("{");
     // read in transformations: 
     // apply to the LEFT side of the current matrix (so the first
     // transform in the list is the last applied to the object)
-    getToken(token);
+    token = readToken();
 
     while (1) {
-        if (!strcmp(token,"Scale")) {
+        if (token == "Scale") {
             Vector3f s = readVector3f();
             matrix = matrix * Matrix4f::scaling( s[0], s[1], s[2] );
-        } else if (!strcmp(token,"UniformScale")) {
+        } else if (token == "UniformScale") {
             float s = readFloat();
             matrix = matrix * Matrix4f::uniformScaling( s );
-        } else if (!strcmp(token,"Translate")) {
+        } else if (token == "Translate") {
             matrix = matrix * Matrix4f::translation( readVector3f() );
-        } else if (!strcmp(token,"XRotate")) {
+        } else if (token == "XRotate") {
             matrix = matrix * Matrix4f::rotateX(DegreesToRadians(readFloat()));
-        } else if (!strcmp(token,"YRotate")) {
+        } else if (token == "YRotate") {
             matrix = matrix * Matrix4f::rotateY(DegreesToRadians(readFloat()));
-        } else if (!strcmp(token,"ZRotate")) {
+        } else if (token == "ZRotate") {
             matrix = matrix * Matrix4f::rotateZ(DegreesToRadians(readFloat()));
-        } else if (!strcmp(token,"Rotate")) {
-            getToken(token); assert (!strcmp(token, "{"));
+        } else if (token == "Rotate") {
+            expectToken("{");
             Vector3f axis = readVector3f();
             float degrees = readFloat();
             float radians = DegreesToRadians(degrees);
             matrix = matrix * Matrix4f::rotation(axis,radians);
-            getToken(token); assert (!strcmp(token, "}"));
-        } else if (!strcmp(token,"Matrix4f")) {
+            expectToken("}");
+        } else if (token == "Matrix4f") {
             Matrix4f matrix2 = Matrix4f::identity();
-            getToken(token); assert (!strcmp(token, "{"));
+            expectToken("{");
             for (int j = 0; j < 4; j++) {
 	            for (int i = 0; i < 4; i++) {
             	    float v = readFloat();
 	                matrix2( i, j ) = v; 
             	} 
             }
-            getToken(token); assert (!strcmp(token, "}"));
+            expectToken("}");
             matrix = matrix2 * matrix;
         } else {
             // otherwise this must be an object,
@@ -427,68 +498,130 @@ Transform* SceneParser::parseTransform() {
             object = parseObject(token);
             break;
         }
-        getToken(token);
+        token = readToken();
     }
 
-    assert(object != NULL);
-    getToken(token); assert (!strcmp(token, "}"));
-    return new Transform(matrix, object);
+    expectToken("}");
+
+    // collapse directly nested transforms into a single matrix,
+    // so rays pay for one transform per chain instead of one per level
+    Transform *inner = dynamic_cast<Transform*>(object);
+    while (inner != NULL) {
+        matrix = matrix * inner->getMatrix();
+        object = inner->getObject();
+        inner = dynamic_cast<Transform*>(object);
+    }
+    return arena.create<Transform>(matrix, object);
 }
 
 // ====================================================================
 // ====================================================================
 
-int SceneParser::getToken(char token[MAX_PARSER_TOKEN_LENGTH]) {
+bool SceneParser::getToken(std::string_view& token) {
     // for simplicity, tokens must be separated by whitespace
-    assert (file != NULL);
-    int success = fscanf(file,"%s ",token);
-    if (success == EOF) {
-        token[0] = '\0';
-        return 0;
+    assert (cursor != NULL);
+    while (cursor < end && isspace((unsigned char)*cursor)) {
+        if (*cursor == '\n') {
+            line++;
+        }
+        cursor++;
+    }
+    const char* start = cursor;
+    while (cursor < end && !isspace((unsigned char)*cursor)) {
+        cursor++;
     }
-    return 1;
+    token = std::string_view(start, cursor - start);
+    return !token.empty();
 }
 
 
-Vector3f SceneParser::readVector3f() {
-    float x,y,z;
-    int count = fscanf(file,"%f %f %f",&x,&y,&z);
-    if (count != 3) {
-        printf ("Error trying to read 3 floats to make a Vector3f\n");
-        assert (0);
+std::string_view SceneParser::readToken() {
+    std::string_view token;
+    if (!getToken(token)) {
+        parseError("Unexpected end of file");
+    }
+    return token;
+}
+
+
+void SceneParser::refit() {
+    for (auto& entry : meshes) {
+        entry.second->refit();
+    }
+    if (group != NULL) {
+        group->refit();
+    }
+}
+
+
+void SceneParser::expectToken(const char* expected) {
+    std::string_view token = readToken();
+    if (token != expected) {
+        parseError("Expected '%s' but found '%.*s'", expected, (int)token.size(), token.data());
     }
+}
+
+
+void SceneParser::parseError(const char* format, ...) {
+    fprintf (stderr, "%s:%d: ", filename, line);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf (stderr, "\n");
+    exit(1);
+}
+
+
+void SceneParser::requireMaterial() {
+    if (current_material == NULL) {
+        parseError("Object without a material, add a MaterialIndex before it");
+    }
+}
+
+
+Vector3f SceneParser::readVector3f() {
+    float x = readFloat();
+    float y = readFloat();
+    float z = readFloat();
     return Vector3f(x,y,z);
 }
 
 
 Vector2f SceneParser::readVec2f() {
-    float u,v;
-    int count = fscanf(file,"%f %f",&u,&v);
-    if (count != 2) {
-        printf ("Error trying to read 2 floats to make a Vec2f\n");
-        assert (0);
-    }
+    float u = readFloat();
+    float v = readFloat();
     return Vector2f(u,v);
 }
 
 
 float SceneParser::readFloat() {
+    std::string_view token = readToken();
+    const char* first = token.data();
+    const char* last = first + token.size();
+    if (*first == '+') {
+        first++;
+    }
     float answer;
-    int count = fscanf(file,"%f",&answer);
-    if (count != 1) {
-        printf ("Error trying to read 1 float\n");
-        assert (0);
+    std::from_chars_result res = std::from_chars(first, last, answer);
+    if (res.ec != std::errc() || res.ptr != last) {
+        parseError("Expected a float but found '%.*s'", (int)token.size(), token.data());
     }
     return answer;
 }
 
 
 int SceneParser::readInt() {
+    std::string_view token = readToken();
+    const char* first = token.data();
+    const char* last = first + token.size();
+    if (*first == '+') {
+        first++;
+    }
     int answer;
-    int count = fscanf(file,"%d",&answer);
-    if (count != 1) {
-        printf ("Error trying to read 1 int\n");
-        assert (0);
+    std::from_chars_result res = std::from_chars(first, last, answer);
+    if (res.ec != std::errc() || res.ptr != last) {
+        parseError("Expected an int but found '%.*s'", (int)token.size(), token.data());
     }
     return answer;
 }
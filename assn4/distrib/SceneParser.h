@@ -2,6 +2,9 @@
 #define SCENE_PARSER_H
 
 #include <cassert>
+#include <map>
+#include <string>
+#include <string_view>
 #include <vecmath.h>
 
 #include "SceneParser.h"
@@ -15,6 +18,8 @@
 #include "Plane.h"
 #include "Triangle.h"
 #include "Transform.h"
+#include "SphereSet.h"
+#include "Arena.h"
 
 /*
 class Camera;
@@ -27,8 +32,6 @@ class Plane;
 class Triangle;
 class Transform;
 */
-#define MAX_PARSER_TOKEN_LENGTH 100
-
 class SceneParser
 {
 public:
@@ -78,6 +81,11 @@ public:
         return group;
     }
 
+    ///updates the scene's BVHs for the next frame after Transforms or
+    ///mesh vertices moved: every loaded mesh is refit once, however many
+    ///instances share it, then the object tree
+    void refit();
+
 private:
 
     SceneParser()
@@ -88,27 +96,43 @@ private:
     void parseFile();
     void parsePerspectiveCamera();
     void parseBackground();
+    void parseAccelerator();
+    BVH::Quality readBVHQuality();
     void parseLights();
     Light* parseDirectionalLight();
 	Light* parsePointLight();
     void parseMaterials();
     Material* parseMaterial();
 
-    Object3D* parseObject( char token[ MAX_PARSER_TOKEN_LENGTH ] );
+    Object3D* parseObject( std::string_view token );
     Group* parseGroup();
     Sphere* parseSphere();
     Plane* parsePlane();
     Triangle* parseTriangle();
-    Mesh* parseTriangleMesh();
+    Object3D* parseTriangleMesh();
+    SphereSet* parseSphereSet();
     Transform* parseTransform();
 
-    int getToken( char token[ MAX_PARSER_TOKEN_LENGTH ] );
+    // tokens are views into the file contents, valid while parsing
+    bool getToken( std::string_view& token );
+    std::string_view readToken();
+    void expectToken( const char* expected );
+    // prints the message with the current file and line to stderr, then
+    // exits with status 1
+    void parseError( const char* format, ... );
+    void requireMaterial();
     Vector3f readVector3f();
     Vector2f readVec2f();
     float readFloat();
     int readInt();
 
-    FILE* file;
+    const char* filename;
+    const char* cursor;
+    const char* end;
+    int line;
+    // groups open around the current token; hits and occluders record a
+    // child index per group, at most HIT_MAX_DEPTH
+    int groupDepth;
     Camera* camera;
     Vector3f background_color;
     Vector3f ambient_light;
@@ -117,7 +141,13 @@ private:
     int num_materials;
     Material** materials;
     Material* current_material;
+    BVH::Quality bvhQuality;
     Group* group;
+    // owns everything parsed from the file, in parse order, so the
+    // children of a group sit next to each other
+    Arena arena;
+    // every obj file is loaded once per BVH build and shared by all its instances
+    std::map< std::pair< std::string, BVH::Quality >, Mesh* > meshes;
 };
 
 #endif // SCENE_PARSER_H
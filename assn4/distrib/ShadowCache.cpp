@@ -0,0 +1,54 @@
+#include "ShadowCache.h"
+#include "Object3D.h"
+#include <cstdio>
+#include <stdint.h>
+
+ShadowCache::ShadowCache() :
+    rays( 0 ), hits( 0 ), misses( 0 )
+{
+    for( int i = 0; i < SHADOW_CACHE_SIZE; i++ )
+    {
+        entries[i].light = NULL;
+    }
+}
+
+bool ShadowCache::occluded( Object3D* scene, const Light* light, const Ray& r, float tmin, float tmax )
+{
+    rays++;
+    // Fibonacci hashing of the light's address
+    uint64_t key = ( uint64_t )( uintptr_t )light * 0x9e3779b97f4a7c15ull;
+    Entry& entry = entries[ key >> 32 & ( SHADOW_CACHE_SIZE - 1 ) ];
+    if( entry.light == light &&
+        scene->occludedBy( r, tmin, tmax, entry.occluder, entry.occluder.getDepth() ) )
+    {
+        hits++;
+        return true;
+    }
+    Occluder occluder;
+    if( !scene->findOccluder( r, tmin, tmax, occluder ) )
+    {
+        // keep the old occluder, lit hits often lie between shadowed ones
+        return false;
+    }
+    misses++;
+    if( occluder.isValid() )
+    {
+        entry.light = light;
+        entry.occluder = occluder;
+    }
+    return true;
+}
+
+void ShadowCache::addStats( const ShadowCache& other )
+{
+    rays += other.rays;
+    hits += other.hits;
+    misses += other.misses;
+}
+
+void ShadowCache::printStats() const
+{
+    long long blocked = hits + misses;
+    printf( "shadow cache: %lld rays, %lld blocked, %lld by the cached occluder (%.1f%% of blocked)\n",
+            rays, blocked, hits, blocked > 0 ? 100.0 * hits / blocked : 0.0 );
+}
@@ -0,0 +1,68 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include "Ray.h"
+#include "Hit.h"
+
+class Object3D;
+class Light;
+
+// entries of a ShadowCache, a power of two
+#define SHADOW_CACHE_SIZE 128
+
+///Remembers, per light, the primitive that blocked the last shadow ray
+///toward it. Shadow rays from neighbouring hits toward the same light
+///are often blocked by the same primitive, which occluded() tests alone
+///before it falls back to a full traversal. The answer is the same as
+///Object3D::occluded, only cheaper when the guess is right.
+///
+///Lights map to a small direct-mapped table, so scenes with thousands
+///of lights keep a bounded cache. Not thread safe: every render thread
+///needs its own.
+class ShadowCache
+{
+public:
+
+    ShadowCache();
+
+    ///any-hit test of scene on [tmin, tmax), r being a shadow ray toward light
+    bool occluded( Object3D* scene, const Light* light, const Ray& r, float tmin, float tmax );
+
+    ///shadow rays tested
+    long long getRays() const
+    {
+        return rays;
+    }
+
+    ///rays blocked by the cached occluder, which skipped the traversal
+    long long getHits() const
+    {
+        return hits;
+    }
+
+    ///rays blocked by a primitive found by a full traversal
+    long long getMisses() const
+    {
+        return misses;
+    }
+
+    ///adds the statistics of another cache, to sum over threads
+    void addStats( const ShadowCache& other );
+
+    void printStats() const;
+
+private:
+
+    struct Entry
+    {
+        const Light* light;
+        Occluder occluder;
+    };
+
+    Entry entries[ SHADOW_CACHE_SIZE ];
+    long long rays;
+    long long hits;
+    long long misses;
+};
+
+#endif // SHADOW_CACHE_H
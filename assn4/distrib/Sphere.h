@@ -7,8 +7,16 @@
 
 #include <iostream>
 using namespace std;
-///TODO:
-///Implement functions and add more fields as necessary
+
+///four spheres in SoA form, lane i of every array belongs to sphere i,
+///so intersectSpheres tests them against one ray in one pass
+struct alignas(16) SphereBlock
+{
+	float center[3][4];
+	float radius[4];
+};
+
+///Sphere given by center and radius, with scalar and SSE intersection tests
 class Sphere: public Object3D
 {
 public:
@@ -27,49 +35,142 @@ public:
 	~Sphere(){}
 
 	virtual bool intersect( const Ray& r , Hit& h , float tmin){
-		float a = Vector3f::dot(r.getDirection(), r.getDirection());
-		float b = 2 * Vector3f::dot(r.getDirection(), r.getOrigin());
-		float c = Vector3f::dot(r.getOrigin(), r.getOrigin()) - radius * radius;
+		float t;
+		if (!intersectSphere(r, origin, radius, tmin, h.getT(), t))
+		{
+			return false;
+		}
+		h.record(t);
+		return true;
+	}
+
+	virtual void getAttributes(const Ray& r, Hit& h) {
+		h.set(h.getT(), material, (r.pointAtParameter(h.getT()) - origin).normalized());
+	}
 
-		float D = sqrt(b * b  - 4*a*c);
-		
+	virtual bool occluded(const Ray& r, float tmin, float tmax) {
+		float t;
+		return intersectSphere(r, origin, radius, tmin, tmax, t);
+	}
+
+	///nearest intersection of a ray with a sphere
+	///@return true if a root lies in [tmin, tmax), t is then the nearest one
+	static bool intersectSphere(const Ray& r, const Vector3f& center, float radius,
+		float tmin, float tmax, float& t) {
+		Vector3f oc = r.getOrigin() - center;
+		float a = Vector3f::dot(r.getDirection(), r.getDirection());
+		float halfB = Vector3f::dot(r.getDirection(), oc);
+		float c = Vector3f::dot(oc, oc) - radius * radius;
+		float D = halfB * halfB - a * c;
 		if (D < 0)
 		{
 			return false;
 		}
+		float sq = sqrt(D);
+		t = (-halfB - sq) / a;
+		if (t < tmin)
+		{
+			t = (-halfB + sq) / a;
+		}
+		return t >= tmin && t < tmax;
+	}
 
-		float t1 = FLT_MAX;
-		float t2 = FLT_MAX;
+#ifdef RT_USE_SSE
+	virtual int intersectPacket(const RayPacket& p, HitPacket& h, float tmin) {
+		__m128 t;
+		int mask = intersectSphere(p, origin, radius, _mm_set1_ps(tmin), h.getT(), t);
+		float ts[4];
+		_mm_storeu_ps(ts, t);
+		for (int i = 0; i < PACKET_SIZE; i++)
+		{
+			if (mask & (1 << i))
+			{
+				h[i].record(ts[i]);
+			}
+		}
+		return mask;
+	}
 
-		if (D == 0)
+	///sphere test of the four rays of a packet
+	///@return bit i is set if ray i hits within [tmin, tmax)
+	static int intersectSphere(const RayPacket& p, const Vector3f& center, float radius,
+		__m128 tmin, __m128 tmax, __m128& t) {
+		__m128 oc[3];
+		for (int k = 0; k < 3; k++)
 		{
-			t1 = (-b + D) / (2 * a);
+			oc[k] = _mm_sub_ps(p.o[k], _mm_set1_ps(center[k]));
 		}
-		else if (D > 0)
+		__m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p.d[0], p.d[0]),
+			_mm_mul_ps(p.d[1], p.d[1])), _mm_mul_ps(p.d[2], p.d[2]));
+		__m128 halfB = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p.d[0], oc[0]),
+			_mm_mul_ps(p.d[1], oc[1])), _mm_mul_ps(p.d[2], oc[2]));
+		__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(oc[0], oc[0]),
+			_mm_mul_ps(oc[1], oc[1])), _mm_mul_ps(oc[2], oc[2])), _mm_set1_ps(radius * radius));
+		__m128 D = _mm_sub_ps(_mm_mul_ps(halfB, halfB), _mm_mul_ps(a, c));
+		int mask = _mm_movemask_ps(_mm_cmpge_ps(D, _mm_setzero_ps()));
+		if (!mask)
 		{
-			t1 = (-b + D) / (2 * a);
-			t2 = (-b - D) / (2 * a);
+			t = _mm_setzero_ps();
+			return 0;
 		}
 
-		float smallerPositive;
-		if (t1 >= 0 && t2 >= 0)
+		__m128 sq = _mm_sqrt_ps(_mm_max_ps(D, _mm_setzero_ps()));
+		__m128 invA = _mm_div_ps(_mm_set1_ps(1.0f), a);
+		__m128 tNear = _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(halfB, sq)), invA);
+		__m128 tFar = _mm_mul_ps(_mm_sub_ps(sq, halfB), invA);
+		// nearest root in front of tmin
+		__m128 useNear = _mm_cmpge_ps(tNear, tmin);
+		t = _mm_or_ps(_mm_and_ps(useNear, tNear), _mm_andnot_ps(useNear, tFar));
+		return mask & _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(t, tmin), _mm_cmplt_ps(t, tmax)));
+	}
+
+	///test of the four spheres of a block against one ray, same roots as
+	///the scalar intersectSphere
+	///@param o d the ray origin and direction, each component in all lanes
+	///@param a dot(d, d) in all lanes
+	///@return bit i is set if sphere i is hit within [tmin, tmax), t is then its nearest root
+	static int intersectSpheres(const __m128* o, const __m128* d, __m128 a, const SphereBlock& b,
+		__m128 tmin, __m128 tmax, __m128& t) {
+		__m128 oc[3];
+		for (int k = 0; k < 3; k++)
 		{
-			smallerPositive = min(t1, t2);
+			oc[k] = _mm_sub_ps(o[k], _mm_load_ps(b.center[k]));
 		}
-		else
+		__m128 radius = _mm_load_ps(b.radius);
+		__m128 halfB = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], oc[0]),
+			_mm_mul_ps(d[1], oc[1])), _mm_mul_ps(d[2], oc[2]));
+		__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(oc[0], oc[0]),
+			_mm_mul_ps(oc[1], oc[1])), _mm_mul_ps(oc[2], oc[2])), _mm_mul_ps(radius, radius));
+		__m128 D = _mm_sub_ps(_mm_mul_ps(halfB, halfB), _mm_mul_ps(a, c));
+		// the discriminant is checked before any root is taken
+		int mask = _mm_movemask_ps(_mm_cmpge_ps(D, _mm_setzero_ps()));
+		if (!mask)
 		{
-			smallerPositive = max(t1, t2);
+			t = _mm_setzero_ps();
+			return 0;
 		}
 
-		if (smallerPositive >= tmin && smallerPositive < h.getT())
-		{
-			Vector3f norm = (origin - r.pointAtParameter(smallerPositive)).normalized();
-			h.set(smallerPositive, material, norm);
+		__m128 sq = _mm_sqrt_ps(_mm_max_ps(D, _mm_setzero_ps()));
+		__m128 tNear = _mm_div_ps(_mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(halfB, sq)), a);
+		__m128 tFar = _mm_div_ps(_mm_sub_ps(sq, halfB), a);
+		__m128 useNear = _mm_cmpge_ps(tNear, tmin);
+		t = _mm_or_ps(_mm_and_ps(useNear, tNear), _mm_andnot_ps(useNear, tFar));
+		return mask & _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(t, tmin), _mm_cmplt_ps(t, tmax)));
+	}
+#endif
 
-			return true;
-		}
+	virtual bool getBounds(BBox& box) const {
+		Vector3f r(radius, radius, radius);
+		box = BBox(origin - r, origin + r);
+		return true;
+	}
+
+	const Vector3f& getCenter() const {
+		return origin;
+	}
 
-		return false;
+	float getRadius() const {
+		return radius;
 	}
 
 protected:
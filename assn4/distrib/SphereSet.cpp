@@ -0,0 +1,266 @@
+#include "SphereSet.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#define SPHERE_SET_VERSION 1
+
+namespace
+{
+    struct SphereSetHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t count;
+    };
+}
+
+SphereSet::SphereSet( const char* filename, Material* m, BVH::Quality quality ) :
+    Object3D( m ), numSpheres( 0 )
+{
+    MappedFile f( filename );
+    SphereSetHeader header;
+    if( f.data == NULL || f.size < sizeof( header ) )
+    {
+        fprintf( stderr, "Cannot open sphere set %s\n", filename );
+        return;
+    }
+    memcpy( &header, f.data, sizeof( header ) );
+    if( memcmp( header.magic, "A4SP", 4 ) != 0 || header.version != SPHERE_SET_VERSION ||
+        ( f.size - sizeof( header ) ) / sizeof( SphereRecord ) < header.count )
+    {
+        fprintf( stderr, "Ignoring invalid sphere set %s\n", filename );
+        return;
+    }
+
+    // the file is mapped, read the records in place
+    const SphereRecord* spheres = ( const SphereRecord* )( f.data + sizeof( header ) );
+    numSpheres = ( int )header.count;
+    std::vector< BBox > bounds( numSpheres );
+    for( int i = 0; i < numSpheres; i++ )
+    {
+        SphereRecord s;
+        memcpy( &s, spheres + i, sizeof( s ) );
+        Vector3f center( s.center[0], s.center[1], s.center[2] );
+        Vector3f r( s.radius, s.radius, s.radius );
+        bounds[i] = BBox( center - r, center + r );
+        box.extend( bounds[i] );
+    }
+    bvh.setLeafBlockSize( 4 );
+    bvh.build( bounds, 4, quality );
+    bvh.alignLeaves();
+
+    blocks.resize( bvh.primIndices.size() / 4 );
+    for( unsigned int i = 0; i < bvh.primIndices.size(); i++ )
+    {
+        SphereRecord s;
+        memcpy( &s, spheres + bvh.primIndices[i], sizeof( s ) );
+        SphereBlock& b = blocks[ i / 4 ];
+        for( int k = 0; k < 3; k++ )
+        {
+            b.center[k][ i % 4 ] = s.center[k];
+        }
+        b.radius[ i % 4 ] = s.radius;
+        bvh.primIndices[i] = i;
+    }
+}
+
+bool SphereSet::save( const char* filename, const std::vector< SphereRecord >& spheres )
+{
+    FILE* file = fopen( filename, "wb" );
+    if( file == NULL )
+    {
+        return false;
+    }
+    SphereSetHeader header;
+    memcpy( header.magic, "A4SP", 4 );
+    header.version = SPHERE_SET_VERSION;
+    header.count = spheres.size();
+    bool ok = fwrite( &header, sizeof( header ), 1, file ) == 1 &&
+        ( spheres.empty() || fwrite( &spheres[0], sizeof( SphereRecord ), spheres.size(), file ) == spheres.size() );
+    return fclose( file ) == 0 && ok;
+}
+
+bool SphereSet::intersect( const Ray& r, Hit& h, float tmin )
+{
+#ifdef RT_USE_SSE
+    __m128 o[3], d[3];
+    for( int k = 0; k < 3; k++ )
+    {
+        o[k] = _mm_set1_ps( r.getOrigin()[k] );
+        d[k] = _mm_set1_ps( r.getDirection()[k] );
+    }
+    __m128 a = _mm_set1_ps( Vector3f::dot( r.getDirection(), r.getDirection() ) );
+    __m128 tmin4 = _mm_set1_ps( tmin );
+    return bvh.intersectLeaves( r, h, tmin, [&]( int first, int count ) {
+        bool result = false;
+        for( int i = 0; i < count; i += 4 )
+        {
+            __m128 t;
+            int mask = Sphere::intersectSpheres( o, d, a, blocks[ ( first + i ) / 4 ], tmin4,
+                _mm_set1_ps( h.getT() ), t );
+            mask &= ( 1 << std::min( count - i, 4 ) ) - 1;
+            if( !mask )
+            {
+                continue;
+            }
+            float ts[4];
+            _mm_storeu_ps( ts, t );
+            int best = -1;
+            for( int j = 0; j < 4; j++ )
+            {
+                if( ( mask & ( 1 << j ) ) && ( best < 0 || ts[j] < ts[ best ] ) )
+                {
+                    best = j;
+                }
+            }
+            h.record( ts[ best ], first + i + best );
+            result = true;
+        }
+        return result;
+    } );
+#else
+    return bvh.intersect( r, h, tmin, [&]( int i ) {
+        float t;
+        if( !Sphere::intersectSphere( r, getCenter( i ), getRadius( i ), tmin, h.getT(), t ) )
+        {
+            return false;
+        }
+        h.record( t, i );
+        return true;
+    } );
+#endif
+}
+
+void SphereSet::getAttributes( const Ray& r, Hit& h )
+{
+    h.set( h.getT(), material, ( r.pointAtParameter( h.getT() ) - getCenter( h.getPrimID() ) ).normalized() );
+}
+
+bool SphereSet::occluded( const Ray& r, float tmin, float tmax )
+{
+#ifdef RT_USE_SSE
+    __m128 o[3], d[3];
+    for( int k = 0; k < 3; k++ )
+    {
+        o[k] = _mm_set1_ps( r.getOrigin()[k] );
+        d[k] = _mm_set1_ps( r.getDirection()[k] );
+    }
+    __m128 a = _mm_set1_ps( Vector3f::dot( r.getDirection(), r.getDirection() ) );
+    __m128 tmin4 = _mm_set1_ps( tmin ), tmax4 = _mm_set1_ps( tmax );
+    return bvh.occludedLeaves( r, tmin, tmax, [&]( int first, int count ) {
+        for( int i = 0; i < count; i += 4 )
+        {
+            __m128 t;
+            int mask = Sphere::intersectSpheres( o, d, a, blocks[ ( first + i ) / 4 ], tmin4, tmax4, t );
+            if( mask & ( ( 1 << std::min( count - i, 4 ) ) - 1 ) )
+            {
+                return true;
+            }
+        }
+        return false;
+    } );
+#else
+    return bvh.occluded( r, tmin, tmax, [&]( int i ) {
+        float t;
+        return Sphere::intersectSphere( r, getCenter( i ), getRadius( i ), tmin, tmax, t );
+    } );
+#endif
+}
+
+bool SphereSet::findOccluder( const Ray& r, float tmin, float tmax, Occluder& occluder )
+{
+#ifdef RT_USE_SSE
+    __m128 o[3], d[3];
+    for( int k = 0; k < 3; k++ )
+    {
+        o[k] = _mm_set1_ps( r.getOrigin()[k] );
+        d[k] = _mm_set1_ps( r.getDirection()[k] );
+    }
+    __m128 a = _mm_set1_ps( Vector3f::dot( r.getDirection(), r.getDirection() ) );
+    __m128 tmin4 = _mm_set1_ps( tmin ), tmax4 = _mm_set1_ps( tmax );
+    return bvh.occludedLeaves( r, tmin, tmax, [&]( int first, int count ) {
+        for( int i = 0; i < count; i += 4 )
+        {
+            __m128 t;
+            int mask = Sphere::intersectSpheres( o, d, a, blocks[ ( first + i ) / 4 ], tmin4, tmax4, t );
+            mask &= ( 1 << std::min( count - i, 4 ) ) - 1;
+            if( mask )
+            {
+                occluder.record( first + i + __builtin_ctz( mask ) );
+                return true;
+            }
+        }
+        return false;
+    } );
+#else
+    return bvh.occluded( r, tmin, tmax, [&]( int i ) {
+        float t;
+        if( !Sphere::intersectSphere( r, getCenter( i ), getRadius( i ), tmin, tmax, t ) )
+        {
+            return false;
+        }
+        occluder.record( i );
+        return true;
+    } );
+#endif
+}
+
+// with SSE the whole block of the recorded sphere, the padding lanes
+// repeat spheres of the same leaf
+bool SphereSet::occludedBy( const Ray& r, float tmin, float tmax, const Occluder& occluder, int /*level*/ )
+{
+    int i = occluder.getPrimID();
+#ifdef RT_USE_SSE
+    __m128 o[3], d[3];
+    for( int k = 0; k < 3; k++ )
+    {
+        o[k] = _mm_set1_ps( r.getOrigin()[k] );
+        d[k] = _mm_set1_ps( r.getDirection()[k] );
+    }
+    __m128 a = _mm_set1_ps( Vector3f::dot( r.getDirection(), r.getDirection() ) );
+    __m128 t;
+    return Sphere::intersectSpheres( o, d, a, blocks[ i / 4 ], _mm_set1_ps( tmin ), _mm_set1_ps( tmax ), t ) != 0;
+#else
+    float t;
+    return Sphere::intersectSphere( r, getCenter( i ), getRadius( i ), tmin, tmax, t );
+#endif
+}
+
+#ifdef RT_USE_SSE
+int SphereSet::intersectPacket( const RayPacket& p, HitPacket& h, float tmin )
+{
+    __m128 tmin4 = _mm_set1_ps( tmin );
+    return bvh.intersectPacket( p, h, tmin, [&]( int i ) {
+        __m128 t;
+        int mask = Sphere::intersectSphere( p, getCenter( i ), getRadius( i ), tmin4, h.getT(), t );
+        if( !mask )
+        {
+            return 0;
+        }
+        float ts[4];
+        _mm_storeu_ps( ts, t );
+        for( int j = 0; j < PACKET_SIZE; j++ )
+        {
+            if( mask & ( 1 << j ) )
+            {
+                h[j].record( ts[j], i );
+            }
+        }
+        return mask;
+    } );
+}
+#endif
+
+bool SphereSet::getBounds( BBox& b ) const
+{
+    if( numSpheres == 0 )
+    {
+        return false;
+    }
+    b = box;
+    return true;
+}
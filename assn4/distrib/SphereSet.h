@@ -0,0 +1,71 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include <vector>
+#include "Object3D.h"
+#include "Sphere.h"
+#include "BVH.h"
+
+///one sphere as stored in a sphere set file
+struct SphereRecord
+{
+    float center[3];
+    float radius;
+};
+
+///Many spheres with one material, such as the particles of a simulation
+///dump. Centers and radii are kept in SoA blocks of four in BVH leaf
+///order and every leaf is tested with Sphere::intersectSpheres, instead
+///of one Sphere object per particle.
+///
+///File format, native byte order:
+///  char magic[4] = "A4SP", uint32_t version = 1, uint64_t count,
+///  then count SphereRecords.
+class SphereSet : public Object3D
+{
+public:
+
+    ///loads filename; the set stays empty if it cannot be read
+    SphereSet( const char* filename, Material* m, BVH::Quality quality = BVH::SAH );
+
+    ///writes spheres in the format the constructor reads
+    static bool save( const char* filename, const std::vector< SphereRecord >& spheres );
+
+    virtual bool intersect( const Ray& r, Hit& h, float tmin );
+    virtual void getAttributes( const Ray& r, Hit& h );
+    virtual bool occluded( const Ray& r, float tmin, float tmax );
+    ///records the blocking sphere
+    virtual bool findOccluder( const Ray& r, float tmin, float tmax, Occluder& occluder );
+    virtual bool occludedBy( const Ray& r, float tmin, float tmax, const Occluder& occluder, int level );
+#ifdef RT_USE_SSE
+    virtual int intersectPacket( const RayPacket& p, HitPacket& h, float tmin );
+#endif
+    virtual bool getBounds( BBox& b ) const;
+
+    int size() const
+    {
+        return numSpheres;
+    }
+
+private:
+
+    Vector3f getCenter( int i ) const
+    {
+        const SphereBlock& b = blocks[ i / 4 ];
+        return Vector3f( b.center[0][ i % 4 ], b.center[1][ i % 4 ], b.center[2][ i % 4 ] );
+    }
+
+    float getRadius( int i ) const
+    {
+        return blocks[ i / 4 ].radius[ i % 4 ];
+    }
+
+    int numSpheres;
+    BBox box;
+    // leaf order, every leaf starting on a block; the padding repeats a
+    // sphere of the leaf. Sphere i of the BVH is lane i % 4 of block i / 4.
+    std::vector< SphereBlock > blocks;
+    BVH bvh;
+};
+
+#endif // SPHERE_SET_H
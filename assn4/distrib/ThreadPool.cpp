@@ -0,0 +1,187 @@
+#include "ThreadPool.h"
+
+static thread_local int threadIndex = 0;
+static int globalThreads = 0;
+
+ThreadPool::ThreadPool( int numThreads ) :
+    queued( 0 ), nextQueue( 0 ), stopping( false )
+{
+    if( numThreads <= 0 )
+    {
+        numThreads = ( int )std::thread::hardware_concurrency();
+    }
+    if( numThreads <= 0 )
+    {
+        numThreads = 1;
+    }
+    for( int i = 0; i < numThreads; i++ )
+    {
+        queues.push_back( new Queue() );
+    }
+    for( int i = 1; i < numThreads; i++ )
+    {
+        workers.push_back( std::thread( &ThreadPool::workerLoop, this, i ) );
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard< std::mutex > guard( sleepLock );
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for( unsigned int i = 0; i < workers.size(); i++ )
+    {
+        workers[i].join();
+    }
+    for( unsigned int i = 0; i < queues.size(); i++ )
+    {
+        delete queues[i];
+    }
+}
+
+ThreadPool& ThreadPool::global()
+{
+    static ThreadPool pool( globalThreads );
+    return pool;
+}
+
+void ThreadPool::setGlobalThreads( int numThreads )
+{
+    globalThreads = numThreads;
+}
+
+int ThreadPool::getThreadIndex()
+{
+    return threadIndex;
+}
+
+void ThreadPool::submit( TaskGroup& group, const std::function< void() >& task )
+{
+    group.pending.fetch_add( 1, std::memory_order_relaxed );
+
+    int index = threadIndex;
+    if( index == 0 )
+    {
+        index = nextQueue.fetch_add( 1, std::memory_order_relaxed ) % queues.size();
+    }
+    Task t;
+    t.func = task;
+    t.group = &group;
+    {
+        std::lock_guard< std::mutex > guard( queues[ index ]->lock );
+        queues[ index ]->tasks.push_back( t );
+    }
+    queued.fetch_add( 1, std::memory_order_release );
+    {
+        // pairs with the predicate check in workerLoop so no wakeup is lost
+        std::lock_guard< std::mutex > guard( sleepLock );
+    }
+    wakeUp.notify_one();
+}
+
+bool ThreadPool::runOne( int index )
+{
+    Task t;
+    bool found = false;
+    {
+        // own queue, newest first for locality
+        Queue& own = *queues[ index ];
+        std::lock_guard< std::mutex > guard( own.lock );
+        if( !own.tasks.empty() )
+        {
+            t = own.tasks.back();
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    int n = ( int )queues.size();
+    for( int i = 1; i < n && !found; i++ )
+    {
+        // steal the oldest, largest piece of work from a victim
+        Queue& victim = *queues[ ( index + i ) % n ];
+        std::lock_guard< std::mutex > guard( victim.lock );
+        if( !victim.tasks.empty() )
+        {
+            t = victim.tasks.front();
+            victim.tasks.pop_front();
+            found = true;
+        }
+    }
+    if( !found )
+    {
+        return false;
+    }
+    queued.fetch_sub( 1, std::memory_order_relaxed );
+    t.func();
+    if( t.group->pending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+    {
+        // the group's last task: wake the thread blocked in wait() on it.
+        // The group may be gone once the count is zero, so it is not
+        // touched after the decrement.
+        {
+            std::lock_guard< std::mutex > guard( sleepLock );
+        }
+        wakeUp.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::workerLoop( int index )
+{
+    threadIndex = index;
+    while( true )
+    {
+        if( runOne( index ) )
+        {
+            continue;
+        }
+        std::unique_lock< std::mutex > guard( sleepLock );
+        wakeUp.wait( guard, [this]() {
+            return stopping || queued.load( std::memory_order_acquire ) > 0;
+        } );
+        if( stopping )
+        {
+            return;
+        }
+    }
+}
+
+void ThreadPool::wait( TaskGroup& group )
+{
+    int index = threadIndex;
+    while( !group.done() )
+    {
+        if( runOne( index ) )
+        {
+            continue;
+        }
+        // nothing to help with: sleep until a task is queued or the
+        // group's last task finishes
+        std::unique_lock< std::mutex > guard( sleepLock );
+        wakeUp.wait( guard, [this, &group]() {
+            return group.done() || queued.load( std::memory_order_acquire ) > 0;
+        } );
+    }
+}
+
+void ThreadPool::parallelFor( int count, int chunk, const std::function< void( int ) >& body )
+{
+    if( chunk < 1 )
+    {
+        chunk = 1;
+    }
+    TaskGroup group;
+    for( int begin = 0; begin < count; begin += chunk )
+    {
+        int end = begin + chunk < count ? begin + chunk : count;
+        submit( group, [begin, end, &body]() {
+            for( int i = begin; i < end; i++ )
+            {
+                body( i );
+            }
+        } );
+    }
+    wait( group );
+}
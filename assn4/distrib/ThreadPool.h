@@ -0,0 +1,97 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///counts the unfinished tasks submitted under it
+class TaskGroup
+{
+public:
+    TaskGroup() : pending( 0 ) {}
+    bool done() const
+    {
+        return pending.load( std::memory_order_acquire ) == 0;
+    }
+private:
+    friend class ThreadPool;
+    std::atomic< int > pending;
+};
+
+///Work-stealing thread pool.
+///Every thread owns a deque: it pushes and pops its own tasks at the
+///back and, when it runs dry, steals from the front of the others.
+///The thread that created the pool is thread 0 and only runs tasks
+///while it waits on a TaskGroup, so wait() may be called from inside a
+///task to fork nested work.
+class ThreadPool
+{
+public:
+
+    ///@param numThreads total threads including the calling one,
+    ///0 picks std::thread::hardware_concurrency()
+    ThreadPool( int numThreads = 0 );
+    ~ThreadPool();
+
+    int getNumThreads() const
+    {
+        return ( int )queues.size();
+    }
+
+    ///pool shared by the whole program, created on first use
+    static ThreadPool& global();
+
+    ///thread count global() creates its pool with, 0 for all hardware
+    ///threads; only has an effect before the first call to global()
+    static void setGlobalThreads( int numThreads );
+
+    ///index of the calling thread in [0, getNumThreads()),
+    ///0 for threads that do not belong to the pool
+    static int getThreadIndex();
+
+    ///queue a task; tasks submitted from outside the pool are spread
+    ///round robin over the queues, tasks forked by a worker stay local
+    void submit( TaskGroup& group, const std::function< void() >& task );
+
+    ///run tasks until every task of the group has finished, sleeping
+    ///while none is queued
+    void wait( TaskGroup& group );
+
+    ///calls body(i) for i in [0, count), chunk indices per task
+    void parallelFor( int count, int chunk, const std::function< void( int ) >& body );
+
+private:
+
+    struct Task
+    {
+        std::function< void() > func;
+        TaskGroup* group;
+    };
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque< Task > tasks;
+    };
+
+    ThreadPool( const ThreadPool& );
+    ThreadPool& operator = ( const ThreadPool& );
+
+    void workerLoop( int index );
+    bool runOne( int index );
+
+    std::vector< Queue* > queues;
+    std::vector< std::thread > workers;
+    std::atomic< int > queued;
+    std::atomic< unsigned int > nextQueue;
+    std::atomic< bool > stopping;
+    std::mutex sleepLock;
+    std::condition_variable wakeUp;
+};
+
+#endif // THREAD_POOL_H
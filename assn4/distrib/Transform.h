@@ -3,24 +3,105 @@
 
 #include <vecmath.h>
 #include "Object3D.h"
-///TODO implement this class
-///So that the intersect function first transforms the ray
-///Add more fields as necessary
+#include "VecUtils.h"
+///Transform intersects its object in object space: rays are moved there
+///with the inverse matrix and normals come back with the inverse transpose.
+///Both are computed once here. Affine matrices, which is every matrix the
+///scene files can express, are inverted through their 3x3 part and applied
+///without the homogeneous row.
 class Transform: public Object3D
 {
-public: 
+public:
   Transform(){}
  Transform( const Matrix4f& m, Object3D* obj ):o(obj){
-    
+    setMatrix( m );
   }
   ~Transform(){
   }
   virtual bool intersect( const Ray& r , Hit& h , float tmin){
-    return o->intersect( r , h , tmin);
+    // the direction is not renormalized, so t means the same in both spaces
+    return o->intersect( toObject( r ) , h , tmin );
+  }
+
+  virtual void getAttributes( const Ray& r , Hit& h ){
+    o->getAttributes( toObject( r ) , h );
+    h.set( h.getT() , h.getMaterial() , ( normalMatrix * h.getNormal() ).normalized() );
+  }
+
+  virtual bool occluded( const Ray& r , float tmin , float tmax ){
+    return o->occluded( toObject( r ) , tmin , tmax );
+  }
+
+  virtual bool findOccluder( const Ray& r , float tmin , float tmax , Occluder& occluder ){
+    return o->findOccluder( toObject( r ) , tmin , tmax , occluder );
+  }
+
+  virtual bool occludedBy( const Ray& r , float tmin , float tmax , const Occluder& occluder , int level ){
+    return o->occludedBy( toObject( r ) , tmin , tmax , occluder , level );
+  }
+
+  virtual bool getBounds( BBox& box ) const {
+    BBox local;
+    if( !o->getBounds( local ) ){
+      return false;
+    }
+    box = BBox();
+    for( int ii = 0 ; ii < 8 ; ii++ ){
+      Vector3f corner( ( ii & 1 ) ? local.getMax()[0] : local.getMin()[0] ,
+                       ( ii & 2 ) ? local.getMax()[1] : local.getMin()[1] ,
+                       ( ii & 4 ) ? local.getMax()[2] : local.getMin()[2] );
+      box.extend( VecUtils::transformPoint( matrix , corner ) );
+    }
+    return true;
+  }
+
+  const Matrix4f& getMatrix() const {
+    return matrix;
+  }
+
+  Object3D* getObject() const {
+    return o;
+  }
+
+  virtual void refit(){
+    o->refit();
+  }
+
+  ///also used to move the object between frames
+  void setMatrix( const Matrix4f& m ){
+    matrix = m;
+    affine = m( 3 , 0 ) == 0 && m( 3 , 1 ) == 0 && m( 3 , 2 ) == 0 && m( 3 , 3 ) == 1;
+    if( affine ){
+      // [A t]^-1 = [A^-1 -A^-1 t]
+      invLinear = m.getSubmatrix3x3( 0 , 0 ).inverse();
+      invTranslation = -( invLinear * m.getCol( 3 ).xyz() );
+      inverse = Matrix4f::identity();
+      inverse.setSubmatrix3x3( 0 , 0 , invLinear );
+      inverse.setCol( 3 , Vector4f( invTranslation , 1 ) );
+    } else {
+      inverse = m.inverse();
+      invLinear = inverse.getSubmatrix3x3( 0 , 0 );
+    }
+    normalMatrix = invLinear.transposed();
   }
 
  protected:
-  Object3D* o; //un-transformed object	
+  Ray toObject( const Ray& r ) const {
+    if( affine ){
+      return Ray( invLinear * r.getOrigin() + invTranslation ,
+                  invLinear * r.getDirection(), r.getTMax() );
+    }
+    return Ray( VecUtils::transformPoint( inverse , r.getOrigin() ) ,
+                VecUtils::transformDirection( inverse , r.getDirection() ) , r.getTMax() );
+  }
+
+  Object3D* o; //un-transformed object
+  Matrix4f matrix;
+  Matrix4f inverse;
+  bool affine;
+  Matrix3f invLinear; //upper 3x3 of the inverse
+  Vector3f invTranslation;
+  Matrix3f normalMatrix; //inverse transpose of the upper 3x3
 };
 
 #endif //TRANSFORM_H
@@ -7,10 +7,19 @@
 #include <iostream>
 
 using namespace std;
-///TODO: implement this class.
-///Add more fields as necessary,
-///but do not remove hasTex, normals or texCoords
-///they are filled in by other components
+
+///four triangles in SoA form, lane i of every array belongs to triangle i,
+///so intersectTriangles tests them against one ray in one pass
+struct alignas(16) TriangleBlock
+{
+	float v0[3][4];
+	float e1[3][4]; //v1 - v0
+	float e2[3][4]; //v2 - v0
+};
+
+///Triangle with optional vertex normals and texture coordinates, hit with
+///the Moller-Trumbore test; hasTex, normals and texCoords are filled in
+///by other components
 class Triangle: public Object3D
 {
 public:
@@ -18,16 +27,187 @@ public:
         ///@param a b c are three vertex positions of the triangle
 	Triangle( const Vector3f& a, const Vector3f& b, const Vector3f& c, Material* m):Object3D(m){
           hasTex = false;
+          vertices[0] = a;
+          vertices[1] = b;
+          vertices[2] = c;
 	}
 
 	virtual bool intersect( const Ray& ray,  Hit& hit , float tmin){
-		return false;
+		float t, beta, gamma;
+		if(!intersectTriangle(ray, vertices[0], vertices[1] - vertices[0],
+			vertices[2] - vertices[0], tmin, hit.getT(), t, beta, gamma)){
+			return false;
+		}
+		hit.record(t, 0, beta, gamma);
+		return true;
+	}
+
+	virtual void getAttributes( const Ray& /*ray*/, Hit& hit){
+		Vector3f e1 = vertices[1] - vertices[0];
+		Vector3f e2 = vertices[2] - vertices[0];
+		float beta = hit.getBeta(), gamma = hit.getGamma();
+		float alpha = 1 - beta - gamma;
+		Vector3f normal = alpha * normals[0] + beta * normals[1] + gamma * normals[2];
+		if(normal.absSquared() == 0){
+			//no vertex normals, use the face normal
+			normal = Vector3f::cross(e1, e2);
+		}
+		hit.set(hit.getT(), material, normal.normalized());
+		if(hasTex){
+			hit.setTexCoord(alpha * texCoords[0] + beta * texCoords[1] + gamma * texCoords[2],
+				texScale(texCoords, e1, e2));
+		}
+	}
+
+	virtual bool occluded( const Ray& ray , float tmin , float tmax){
+		float t, beta, gamma;
+		return intersectTriangle(ray, vertices[0], vertices[1] - vertices[0],
+			vertices[2] - vertices[0], tmin, tmax, t, beta, gamma);
+	}
+
+	///Moller-Trumbore ray/triangle test
+	///@param v0 first vertex, e1 e2 edges from v0 to the other two vertices
+	///@param beta gamma barycentric coordinates of vertex 1 and 2 at the hit
+	///@return true if the hit lies in [tmin, tmax)
+	static bool intersectTriangle( const Ray& ray, const Vector3f& v0,
+		const Vector3f& e1, const Vector3f& e2, float tmin, float tmax,
+		float& t, float& beta, float& gamma){
+		Vector3f p = Vector3f::cross(ray.getDirection(), e2);
+		float det = Vector3f::dot(e1, p);
+		if(det == 0){
+			return false;
+		}
+		float invDet = 1 / det;
+		Vector3f s = ray.getOrigin() - v0;
+		beta = Vector3f::dot(s, p) * invDet;
+		if(beta < 0 || beta > 1){
+			return false;
+		}
+		Vector3f q = Vector3f::cross(s, e1);
+		gamma = Vector3f::dot(ray.getDirection(), q) * invDet;
+		if(gamma < 0 || beta + gamma > 1){
+			return false;
+		}
+		t = Vector3f::dot(e2, q) * invDet;
+		return t >= tmin && t < tmax;
+	}
+
+#ifdef RT_USE_SSE
+	virtual int intersectPacket( const RayPacket& p, HitPacket& h, float tmin){
+		Vector3f e1 = vertices[1] - vertices[0];
+		Vector3f e2 = vertices[2] - vertices[0];
+		__m128 t, beta, gamma;
+		int mask = intersectTriangle(p, vertices[0], e1, e2, _mm_set1_ps(tmin), h.getT(), t, beta, gamma);
+		float ts[4], bs[4], gs[4];
+		_mm_storeu_ps(ts, t);
+		_mm_storeu_ps(bs, beta);
+		_mm_storeu_ps(gs, gamma);
+		for(int i = 0; i < PACKET_SIZE; i++){
+			if(mask & (1 << i)){
+				h[i].record(ts[i], 0, bs[i], gs[i]);
+			}
+		}
+		return mask;
+	}
+
+	///Moller-Trumbore test of one triangle against the four rays of a packet
+	///@return bit i is set if ray i hits within [tmin, tmax)
+	static int intersectTriangle( const RayPacket& p, const Vector3f& v0,
+		const Vector3f& e1, const Vector3f& e2, __m128 tmin, __m128 tmax,
+		__m128& t, __m128& beta, __m128& gamma){
+		__m128 e1x = _mm_set1_ps(e1[0]), e1y = _mm_set1_ps(e1[1]), e1z = _mm_set1_ps(e1[2]);
+		__m128 e2x = _mm_set1_ps(e2[0]), e2y = _mm_set1_ps(e2[1]), e2z = _mm_set1_ps(e2[2]);
+		// p = d x e2
+		__m128 px = _mm_sub_ps(_mm_mul_ps(p.d[1], e2z), _mm_mul_ps(p.d[2], e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(p.d[2], e2x), _mm_mul_ps(p.d[0], e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(p.d[0], e2y), _mm_mul_ps(p.d[1], e2x));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+		// s = o - v0
+		__m128 sx = _mm_sub_ps(p.o[0], _mm_set1_ps(v0[0]));
+		__m128 sy = _mm_sub_ps(p.o[1], _mm_set1_ps(v0[1]));
+		__m128 sz = _mm_sub_ps(p.o[2], _mm_set1_ps(v0[2]));
+		beta = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+		// q = s x e1
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		gamma = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(p.d[0], qx), _mm_mul_ps(p.d[1], qy)), _mm_mul_ps(p.d[2], qz)), invDet);
+		t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+		__m128 zero = _mm_setzero_ps();
+		__m128 valid = _mm_cmpneq_ps(det, zero);
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(beta, zero));
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(gamma, zero));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(beta, gamma), _mm_set1_ps(1.0f)));
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(t, tmin));
+		valid = _mm_and_ps(valid, _mm_cmplt_ps(t, tmax));
+		return _mm_movemask_ps(valid);
+	}
+
+	///Moller-Trumbore test of the four triangles of a block against one ray
+	///@param o d the ray origin and direction, each component in all lanes
+	///@return bit i is set if triangle i is hit within [tmin, tmax)
+	static int intersectTriangles( const __m128* o, const __m128* d, const TriangleBlock& b,
+		__m128 tmin, __m128 tmax, __m128& t, __m128& beta, __m128& gamma){
+		__m128 e1x = _mm_load_ps(b.e1[0]), e1y = _mm_load_ps(b.e1[1]), e1z = _mm_load_ps(b.e1[2]);
+		__m128 e2x = _mm_load_ps(b.e2[0]), e2y = _mm_load_ps(b.e2[1]), e2z = _mm_load_ps(b.e2[2]);
+		// p = d x e2
+		__m128 px = _mm_sub_ps(_mm_mul_ps(d[1], e2z), _mm_mul_ps(d[2], e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(d[2], e2x), _mm_mul_ps(d[0], e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(d[0], e2y), _mm_mul_ps(d[1], e2x));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+		// s = o - v0
+		__m128 sx = _mm_sub_ps(o[0], _mm_load_ps(b.v0[0]));
+		__m128 sy = _mm_sub_ps(o[1], _mm_load_ps(b.v0[1]));
+		__m128 sz = _mm_sub_ps(o[2], _mm_load_ps(b.v0[2]));
+		beta = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+		// q = s x e1
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		gamma = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qx), _mm_mul_ps(d[1], qy)), _mm_mul_ps(d[2], qz)), invDet);
+		t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+		__m128 zero = _mm_setzero_ps();
+		__m128 valid = _mm_cmpneq_ps(det, zero);
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(beta, zero));
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(gamma, zero));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(beta, gamma), _mm_set1_ps(1.0f)));
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(t, tmin));
+		valid = _mm_and_ps(valid, _mm_cmplt_ps(t, tmax));
+		return _mm_movemask_ps(valid);
+	}
+#endif
+
+	virtual bool getBounds( BBox& box ) const {
+		box = BBox();
+		for(int ii=0;ii<3;ii++){
+			box.extend(vertices[ii]);
+		}
+		return true;
 	}
 	bool hasTex;
 	Vector3f normals[3];
 	Vector2f texCoords[3];
-protected:
 
+	///texture units per world unit, from the areas the triangle covers in both
+	static float texScale(const Vector2f * texCoords, const Vector3f & e1, const Vector3f & e2) {
+		Vector2f t1 = texCoords[1] - texCoords[0];
+		Vector2f t2 = texCoords[2] - texCoords[0];
+		float worldArea = Vector3f::cross(e1, e2).abs();
+		if(worldArea <= 0){
+			return 0;
+		}
+		return sqrt(fabs(t1[0] * t2[1] - t1[1] * t2[0]) / worldArea);
+	}
+
+	const Vector3f& getVertex(int i) const {
+		return vertices[i];
+	}
+protected:
+	Vector3f vertices[3];
 };
 
 #endif //TRIANGLE_H
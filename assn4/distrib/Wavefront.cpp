@@ -0,0 +1,187 @@
+#include "Wavefront.h"
+#include "RayTracer.h"
+#include "SceneParser.h"
+#include "Light.h"
+#include "Material.h"
+#include "Group.h"
+
+#include <algorithm>
+
+void Wavefront::RayQueue::clear()
+{
+    for( int k = 0; k < 3; k++ )
+    {
+        origin[k].clear();
+        direction[k].clear();
+    }
+    tmax.clear();
+    pixel.clear();
+    weight.clear();
+}
+
+void Wavefront::RayQueue::push( const Ray& r, int p, const Vector3f& w )
+{
+    for( int k = 0; k < 3; k++ )
+    {
+        origin[k].push_back( r.getOrigin()[k] );
+        direction[k].push_back( r.getDirection()[k] );
+    }
+    tmax.push_back( r.getTMax() );
+    pixel.push_back( p );
+    weight.push_back( w );
+}
+
+Ray Wavefront::RayQueue::getRay( int i ) const
+{
+    return Ray( Vector3f( origin[0][i], origin[1][i], origin[2][i] ),
+                Vector3f( direction[0][i], direction[1][i], direction[2][i] ), tmax[i] );
+}
+
+Wavefront::Wavefront( const RayTracer* tracer, bool packets ) :
+    tracer( tracer ), packets( packets )
+{
+}
+
+void Wavefront::addCameraRay( const Ray& ray, int p )
+{
+    rays.push( ray, p, Vector3f( 1, 1, 1 ) );
+}
+
+void Wavefront::trace( float tmin, Vector3f* colors, RayBudget* budget, ShadowCache* shadowCache )
+{
+    for( int i = 0; i < rays.size(); i++ )
+    {
+        colors[ rays.pixel[i] ] = Vector3f::ZERO;
+    }
+    // secondary rays are only as coherent as the hits they leave from,
+    // packets are kept to the camera rays
+    for( int depth = 0; rays.size() > 0; depth++ )
+    {
+        intersect( rays, depth == 0 ? tmin : SURFACE_EPSILON, packets && depth == 0 );
+        shade( rays, depth, colors, budget );
+        traceShadows( colors, shadowCache );
+        std::swap( rays, nextRays );
+        nextRays.clear();
+    }
+}
+
+// hits[i] gets the closest hit of ray i with its attributes; a hit with
+// no material is a miss
+void Wavefront::intersect( const RayQueue& queue, float tmin, bool usePackets )
+{
+    hits.resize( queue.size() );
+    for( int i = 0; i < queue.size(); i++ )
+    {
+        hits[i] = Hit( queue.tmax[i], NULL, Vector3f( 0, 0, 0 ) );
+    }
+    Group* group = tracer->group;
+    if( group == NULL )
+    {
+        return;
+    }
+    // only the rays being traced need a path
+    HitPath childPaths[ PACKET_SIZE ];
+
+    int i = 0;
+#ifndef RT_USE_SSE
+    // without SSE every ray is traced alone
+    ( void )usePackets;
+#else
+    for( ; usePackets && i + PACKET_SIZE <= queue.size(); i += PACKET_SIZE )
+    {
+        Ray r[ PACKET_SIZE ] = { queue.getRay( i ), queue.getRay( i + 1 ),
+                                 queue.getRay( i + 2 ), queue.getRay( i + 3 ) };
+        for( int j = 0; j < PACKET_SIZE; j++ )
+        {
+            hits[ i + j ].setPath( &childPaths[j] );
+        }
+        HitPacket hitPacket( &hits[i] );
+        int mask = group->intersectPacket( RayPacket( r ), hitPacket, tmin );
+        for( int j = 0; j < PACKET_SIZE; j++ )
+        {
+            if( mask & ( 1 << j ) )
+            {
+                group->getAttributes( r[j], hits[ i + j ] );
+                tracer->setFootprint( r[j], hits[ i + j ] );
+            }
+            hits[ i + j ].setPath( NULL );
+        }
+    }
+#endif
+    for( ; i < queue.size(); i++ )
+    {
+        Ray r = queue.getRay( i );
+        hits[i].setPath( &childPaths[0] );
+        if( group->intersect( r, hits[i], tmin ) )
+        {
+            group->getAttributes( r, hits[i] );
+            tracer->setFootprint( r, hits[i] );
+        }
+        hits[i].setPath( NULL );
+    }
+}
+
+// same terms as RayTracer::shade, with every shadow test and secondary
+// ray queued instead of traced
+void Wavefront::shade( const RayQueue& queue, int depth, Vector3f* colors, RayBudget* budget )
+{
+    SceneParser* scene = tracer->scene;
+    order.clear();
+    for( int i = 0; i < queue.size(); i++ )
+    {
+        if( hits[i].getMaterial() == NULL )
+        {
+            colors[ queue.pixel[i] ] += queue.weight[i] * scene->getBackgroundColor();
+        }
+        else
+        {
+            order.push_back( std::make_pair( hits[i].getMaterial(), i ) );
+        }
+    }
+    std::sort( order.begin(), order.end() );
+
+    for( unsigned int ii = 0; ii < order.size(); ii++ )
+    {
+        Material* material = order[ii].first;
+        int i = order[ii].second;
+        const Hit& hit = hits[i];
+        Ray ray = queue.getRay( i );
+        int p = queue.pixel[i];
+        const Vector3f& w = queue.weight[i];
+        colors[p] += w * ( scene->getAmbientLight() * material->getDiffuseColor( hit ) );
+
+        Vector3f point = ray.pointAtParameter( hit.getT() );
+        tracer->forLights( ray, hit, point,
+            [&]( const Light* light, const Vector3f& dirToLight, const Vector3f& lightColor, float distanceToLight ) {
+                Vector3f color = material->Shade( ray, hit, dirToLight, lightColor );
+                if( !tracer->shadows )
+                {
+                    colors[p] += w * color;
+                }
+                else if( color.absSquared() > 0 )
+                {
+                    // surfaces facing away from the light need no shadow ray
+                    shadowRays.push( Ray( point, dirToLight, distanceToLight ), p, w * color );
+                    shadowLights.push_back( light );
+                }
+            } );
+
+        tracer->forSecondaryRays( ray, hit, PathState( depth, w, budget ),
+            [&]( const Ray& secondary, const Vector3f& weight ) {
+                nextRays.push( secondary, p, w * weight );
+            } );
+    }
+}
+
+void Wavefront::traceShadows( Vector3f* colors, ShadowCache* shadowCache )
+{
+    for( int i = 0; i < shadowRays.size(); i++ )
+    {
+        if( !tracer->occluded( shadowRays.getRay( i ), shadowLights[i], shadowCache ) )
+        {
+            colors[ shadowRays.pixel[i] ] += shadowRays.weight[i];
+        }
+    }
+    shadowRays.clear();
+    shadowLights.clear();
+}
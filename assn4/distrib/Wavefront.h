@@ -0,0 +1,89 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <utility>
+#include <vector>
+#include <vecmath.h>
+#include "Ray.h"
+#include "Hit.h"
+
+class RayTracer;
+class RayBudget;
+class Material;
+class Light;
+class ShadowCache;
+
+///Wavefront execution of a RayTracer. Instead of following one ray from
+///the camera to its shading, a whole batch of rays goes through one stage
+///at a time:
+///  1. intersect the queued rays and compute the attributes of their hits
+///  2. sort the hits by Material* and shade them one material after the
+///     other, queueing a shadow ray per light and the reflected and
+///     refracted rays RayTracer would follow
+///  3. trace the shadow queue, adding the light of the rays not blocked
+///The reflected and refracted rays are the next wave. Each stage runs one
+///loop over many rays, so its code and the data it reads stay in cache.
+///Colors match RayTracer::traceRay up to the order of the additions.
+///
+///The queues are reused from batch to batch; every thread needs its own
+///Wavefront.
+class Wavefront
+{
+public:
+
+    ///@param packets intersect the camera rays PACKET_SIZE at a time
+    Wavefront( const RayTracer* tracer, bool packets = false );
+
+    ///queues the camera ray of pixel p of the batch; with packets, every
+    ///PACKET_SIZE consecutive rays should be coherent, such as a 2x2 block
+    void addCameraRay( const Ray& ray, int p );
+
+    ///traces the queued camera rays and every ray they spawn, and empties
+    ///the queue
+    ///@param colors pixel p is written to colors[p], for every p queued
+    ///@param budget secondary rays the batch may spawn, NULL for no limit
+    ///@param shadowCache the calling thread's, NULL to trace every shadow
+    ///ray in full
+    void trace( float tmin, Vector3f* colors, RayBudget* budget = NULL, ShadowCache* shadowCache = NULL );
+
+private:
+
+    ///rays in SoA form, each with the pixel it adds to and its weight
+    struct RayQueue
+    {
+        std::vector< float > origin[3];
+        std::vector< float > direction[3];
+        std::vector< float > tmax;
+        std::vector< int > pixel;
+        std::vector< Vector3f > weight;
+
+        int size() const
+        {
+            return ( int )pixel.size();
+        }
+
+        void clear();
+        void push( const Ray& r, int p, const Vector3f& w );
+        Ray getRay( int i ) const;
+    };
+
+    void intersect( const RayQueue& queue, float tmin, bool usePackets );
+    void shade( const RayQueue& queue, int depth, Vector3f* colors, RayBudget* budget );
+    void traceShadows( Vector3f* colors, ShadowCache* shadowCache );
+
+    const RayTracer* tracer;
+    bool packets;
+    // the current wave and the secondary rays that make the next one
+    RayQueue rays;
+    RayQueue nextRays;
+    // weight is the light a shadow ray adds if nothing blocks it
+    RayQueue shadowRays;
+    // the light shadow ray i goes to
+    std::vector< const Light* > shadowLights;
+    // hit i belongs to ray i of the current wave
+    std::vector< Hit > hits;
+    // the hits in shading order
+    std::vector< std::pair< Material*, int > > order;
+};
+
+#endif // WAVEFRONT_H
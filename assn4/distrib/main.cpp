@@ -8,53 +8,351 @@
 #include "SceneParser.h"
 #include "Image.h"
 #include "Camera.h"
+#include "RayTracer.h"
+#include "Wavefront.h"
+#include "ThreadPool.h"
+#include "MeshCache.h"
 #include <string.h>
+#include <string>
 
 using namespace std;
 
 float clampedDepth(float depthInput, float depthMin, float depthMax);
 
 #include "bitmap_image.hpp"
-int main(int argc, char* argv[])
+
+// map the pixel center to [-1, 1] x [-1, 1]
+Vector2f pixelToScreen(const Image& image, int x, int y)
 {
-	// Fill in your implementation here.
+	return Vector2f(2.0f * (x + 0.5f) / image.Width() - 1,
+		2.0f * (y + 0.5f) / image.Height() - 1);
+}
+
+// Renders the pixels [x0, x1) x [y0, y1).
+// Tiles never overlap, so threads write to disjoint parts of the image.
+// budget caps the secondary rays the tile spawns, NULL for no limit.
+// shadowCache is the calling thread's, NULL to trace every shadow ray in full.
+void renderTile(const RayTracer& tracer, Camera* camera, Image& image,
+	int x0, int y0, int x1, int y1, RayBudget* budget, ShadowCache* shadowCache)
+{
+	for (int y = y0; y < y1; y++)
+	{
+		for (int x = x0; x < x1; x++)
+		{
+			Ray ray = camera->generateRay(pixelToScreen(image, x, y));
+			Hit hit;
+			if (budget != NULL)
+			{
+				budget->beginPixel();
+			}
+			image.SetPixel(x, y, tracer.traceRay(ray, camera->getTMin(), hit, PathState(0, Vector3f(1, 1, 1), budget, shadowCache)));
+		}
+	}
+}
+
+// Same as renderTile, but traces 2x2 pixel blocks as ray packets.
+// Blocks that stick out of the tile are traced one ray at a time.
+void renderTilePackets(const RayTracer& tracer, Camera* camera, Image& image,
+	int x0, int y0, int x1, int y1, RayBudget* budget, ShadowCache* shadowCache)
+{
+	for (int y = y0; y < y1; y += 2)
+	{
+		for (int x = x0; x < x1; x += 2)
+		{
+			if (x + 1 >= x1 || y + 1 >= y1)
+			{
+				renderTile(tracer, camera, image, x, y, min(x + 2, x1), min(y + 2, y1), budget, shadowCache);
+				continue;
+			}
+			Ray rays[PACKET_SIZE] = {
+				camera->generateRay(pixelToScreen(image, x, y)),
+				camera->generateRay(pixelToScreen(image, x + 1, y)),
+				camera->generateRay(pixelToScreen(image, x, y + 1)),
+				camera->generateRay(pixelToScreen(image, x + 1, y + 1)) };
+			Hit hits[PACKET_SIZE];
+			Vector3f colors[PACKET_SIZE];
+			tracer.tracePacket(rays, camera->getTMin(), hits, colors, budget, shadowCache);
+			image.SetPixel(x, y, colors[0]);
+			image.SetPixel(x + 1, y, colors[1]);
+			image.SetPixel(x, y + 1, colors[2]);
+			image.SetPixel(x + 1, y + 1, colors[3]);
+		}
+	}
+}
 
+// Same image as renderTile, traced by a Wavefront: all camera rays of the
+// tile are queued first and go through each stage together. With packets
+// the full 2x2 blocks are queued first, so every four rays are coherent.
+void renderTileWavefront(Wavefront& wavefront, Camera* camera, Image& image,
+	int x0, int y0, int x1, int y1, bool usePackets, RayBudget* budget, ShadowCache* shadowCache)
+{
+	int w = x1 - x0;
+	int blocksX = usePackets ? w / 2 * 2 : 0;
+	int blocksY = usePackets ? (y1 - y0) / 2 * 2 : 0;
+	for (int y = 0; y < blocksY; y += 2)
+	{
+		for (int x = 0; x < blocksX; x += 2)
+		{
+			for (int i = 0; i < PACKET_SIZE; i++)
+			{
+				int p = (y + i / 2) * w + x + i % 2;
+				wavefront.addCameraRay(camera->generateRay(pixelToScreen(image, x0 + p % w, y0 + p / w)), p);
+			}
+		}
+	}
+	for (int y = 0; y < y1 - y0; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			if (x >= blocksX || y >= blocksY)
+			{
+				wavefront.addCameraRay(camera->generateRay(pixelToScreen(image, x0 + x, y0 + y)), y * w + x);
+			}
+		}
+	}
+
+	std::vector<Vector3f> colors(w * (y1 - y0));
+	wavefront.trace(camera->getTMin(), colors.data(), budget, shadowCache);
+	for (int p = 0; p < (int)colors.size(); p++)
+	{
+		image.SetPixel(x0 + p % w, y0 + p / w, colors[p]);
+	}
+}
+
+// output name of one frame: image.bmp becomes image_0003.bmp
+std::string frameName(const char* output, int frame)
+{
+	std::string name(output);
+	size_t dot = name.find_last_of('.');
+	size_t slash = name.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && slash > dot))
+	{
+		dot = name.size();
+	}
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), "_%04d", frame);
+	return name.substr(0, dot) + suffix + name.substr(dot);
+}
+
+// Moves the scene to its next frame: every Transform at the top of the
+// scene turns by radians about the world y axis. Only the BVH boxes are
+// updated, the trees keep the topology of the first frame.
+void nextFrame(SceneParser& sceneParser, float radians)
+{
+	Group* group = sceneParser.getGroup();
+	for (int i = 0; group != NULL && i < group->getGroupSize(); i++)
+	{
+		Transform* transform = dynamic_cast<Transform*>(group->getObject(i));
+		if (transform != NULL)
+		{
+			transform->setMatrix(Matrix4f::rotateY(radians) * transform->getMatrix());
+		}
+	}
+	sceneParser.refit();
+}
+
+int main(int argc, char* argv[])
+{
 	// This loop loops over each of the input arguments.
 	// argNum is initialized to 1 because the first
 	// "argument" provided to the program is actually the
 	// name of the executable (in our case, "a4").
 
-	char* filename;
+	char* filename = NULL;
+	char* output = NULL;
+	int width = 200;
+	int height = 200;
+	int numThreads = 0;
+	int tileSize = 32;
+	bool usePackets = false;
+	bool shadows = false;
+	bool wavefront = false;
+	int maxDepth = RAY_MAX_DEPTH;
+	float budgetPerPixel = -1;
+	int lightSamples = LIGHT_SAMPLES;
+	bool useShadowCache = true;
+	bool shadowStats = false;
+	int numFrames = 1;
+	float spin = 0;
 
 	for (int argNum = 1; argNum < argc; ++argNum)
 	{
-		std::cout << "Argument " << argNum << " is: " << argv[argNum] << std::endl;
-		switch (argNum)
+		if (!strcmp(argv[argNum], "-input") && argNum + 1 < argc)
+		{
+			filename = argv[++argNum];
+		}
+		else if (!strcmp(argv[argNum], "-output") && argNum + 1 < argc)
+		{
+			output = argv[++argNum];
+		}
+		else if (!strcmp(argv[argNum], "-size") && argNum + 2 < argc)
+		{
+			width = atoi(argv[++argNum]);
+			height = atoi(argv[++argNum]);
+		}
+		else if (!strcmp(argv[argNum], "-threads") && argNum + 1 < argc)
 		{
-		case 2: filename = argv[argNum]; break;
-		default:
-			break;
+			// 0 uses every hardware thread
+			numThreads = atoi(argv[++argNum]);
+		}
+		else if (!strcmp(argv[argNum], "-tile") && argNum + 1 < argc)
+		{
+			tileSize = atoi(argv[++argNum]);
+		}
+		else if (!strcmp(argv[argNum], "-packets"))
+		{
+			// trace primary rays in 2x2 SIMD packets
+			usePackets = true;
+		}
+		else if (!strcmp(argv[argNum], "-shadows"))
+		{
+			shadows = true;
+		}
+		else if (!strcmp(argv[argNum], "-noshadowcache"))
+		{
+			// trace every shadow ray through the whole scene, for comparison
+			useShadowCache = false;
+		}
+		else if (!strcmp(argv[argNum], "-shadowstats"))
+		{
+			// print how many shadow rays the occluder caches answered
+			shadowStats = true;
+		}
+		else if (!strcmp(argv[argNum], "-depth") && argNum + 1 < argc)
+		{
+			// reflections and refractions followed after the camera ray
+			maxDepth = atoi(argv[++argNum]);
+		}
+		else if (!strcmp(argv[argNum], "-budget") && argNum + 1 < argc)
+		{
+			// secondary rays per pixel a tile may spawn on average
+			budgetPerPixel = atof(argv[++argNum]);
+		}
+		else if (!strcmp(argv[argNum], "-lightsamples") && argNum + 1 < argc)
+		{
+			// lights picked per hit in scenes with more lights, 0 for all of them
+			lightSamples = atoi(argv[++argNum]);
+		}
+		else if (!strcmp(argv[argNum], "-wavefront"))
+		{
+			// trace each tile stage by stage, shading hits sorted by material
+			wavefront = true;
+		}
+		else if (!strcmp(argv[argNum], "-frames") && argNum + 1 < argc)
+		{
+			// render an animation, refitting the BVHs between frames
+			numFrames = atoi(argv[++argNum]);
+		}
+		else if (!strcmp(argv[argNum], "-spin") && argNum + 1 < argc)
+		{
+			// degrees the top-level Transforms turn per frame
+			spin = atof(argv[++argNum]);
+		}
+		else if (!strcmp(argv[argNum], "-nocache"))
+		{
+			// always parse obj files, never read or write .a4cache files
+			MeshCache::enabled = false;
+		}
+		else if (!strcmp(argv[argNum], "-linear"))
+		{
+			// disable the Group BVH, every child is tested for every ray
+			Group::useBVH = false;
+		}
+		else if (!strcmp(argv[argNum], "-bvhstats"))
+		{
+			// print build time and tree quality of every BVH built
+			BVH::printStats = true;
+		}
+		else
+		{
+			std::cout << "Unknown argument " << argv[argNum] << std::endl;
 		}
 	}
 
-	SceneParser sceneParser(filename);
-
-	// First, parse the scene using SceneParser.
-	// Then loop over each pixel in the image, shooting a ray
-	// through that pixel and finding its intersection with
-	// the scene.  Write the color at the intersection to that
-	// pixel in your output image.
+	if (filename == NULL || output == NULL || width <= 0 || height <= 0 || numFrames <= 0)
+	{
+		std::cout << "Usage: " << argv[0] << " -input scene.txt -output image.bmp"
+			<< " [-size w h] [-threads N] [-tile S] [-packets] [-shadows] [-noshadowcache] [-shadowstats] [-depth N] [-budget N] [-lightsamples N] [-wavefront] [-frames N] [-spin degrees] [-nocache] [-linear] [-bvhstats]" << std::endl;
+		return 1;
+	}
+	if (tileSize <= 0)
+	{
+		tileSize = 32;
+	}
 
+	// The pool is also used while loading, so size it first.
+	ThreadPool::setGlobalThreads(numThreads);
 
+	// First, parse the scene using SceneParser.
+	SceneParser sceneParser(filename);
+	RayTracer tracer(&sceneParser, shadows);
+	tracer.setMaxDepth(maxDepth);
+	tracer.setLightSamples(lightSamples);
+	Camera* camera = sceneParser.getCamera();
 
+	// Then split the image into tiles and let the pool hand them out.
+	// Workers take tiles from their own queue and steal from the
+	// others when they run out, which balances expensive regions.
+	Image image(width, height);
+	// pixels are 2/width by 2/height on the image plane, mip selection
+	// uses the longer side
+	tracer.setPixelSize(2.0f / min(width, height));
+	ThreadPool& pool = ThreadPool::global();
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+	// one set of wavefront queues per thread, reused for all its tiles
+	std::vector<Wavefront> wavefronts(pool.getNumThreads(), Wavefront(&tracer, usePackets));
+	// one last occluder per light and thread, kept from tile to tile
+	std::vector<ShadowCache> shadowCaches(pool.getNumThreads());
+	for (int frame = 0; frame < numFrames; frame++)
+	{
+		if (frame > 0)
+		{
+			nextFrame(sceneParser, spin * (float)M_PI / 180);
+		}
+		pool.parallelFor(tilesX * tilesY, 1, [&](int tile) {
+			int x0 = (tile % tilesX) * tileSize;
+			int y0 = (tile / tilesX) * tileSize;
+			int x1 = min(x0 + tileSize, width);
+			int y1 = min(y0 + tileSize, height);
+			int pixels = (x1 - x0) * (y1 - y0);
+			RayBudget budget(budgetPerPixel < 0 ? -1 : (int)(budgetPerPixel * pixels), pixels);
+			int thread = ThreadPool::getThreadIndex();
+			ShadowCache* shadowCache = useShadowCache ? &shadowCaches[thread] : NULL;
+			if (wavefront)
+			{
+				renderTileWavefront(wavefronts[thread], camera, image, x0, y0,
+					x1, y1, usePackets, &budget, shadowCache);
+			}
+			else if (usePackets)
+			{
+				renderTilePackets(tracer, camera, image, x0, y0, x1, y1, &budget, shadowCache);
+			}
+			else
+			{
+				renderTile(tracer, camera, image, x0, y0, x1, y1, &budget, shadowCache);
+			}
+		});
+		if (numFrames == 1)
+		{
+			image.SaveImage(output);
+		}
+		else
+		{
+			std::string name = frameName(output, frame);
+			image.SaveImage(name.c_str());
+		}
+	}
+	if (shadowStats && useShadowCache)
+	{
+		ShadowCache total;
+		for (int i = 0; i < (int)shadowCaches.size(); i++)
+		{
+			total.addStats(shadowCaches[i]);
+		}
+		total.printStats();
+	}
 
-	///TODO: below demonstrates how to use the provided Image class
-	///Should be removed when you start
-	Vector3f pixelColor(1.0f, 0, 0);
-	//width and height
-	Image image(10, 15);
-	image.SetPixel(5, 5, pixelColor);
-	image.SaveImage("demo.bmp");
 	return 0;
 }
 
@@ -1,58 +1,144 @@
 #include "texture.hpp"
 #include "bitmap_image.hpp"
+#include <cmath>
+
+#define TILE_BITS 3
+#define TILE_SIZE (1 << TILE_BITS)
+#define TILE_MASK (TILE_SIZE - 1)
+
+static int clampInt(int x, int low, int high)
+{
+    return x < low ? low : (x > high ? high : x);
+}
+
+const Vector3f &
+Texture::Level::texel(int x, int y) const
+{
+    int tile = (y >> TILE_BITS) * tilesX + (x >> TILE_BITS);
+    return texels[(tile << (2 * TILE_BITS)) + ((y & TILE_MASK) << TILE_BITS) + (x & TILE_MASK)];
+}
+
+Vector3f &
+Texture::Level::texel(int x, int y)
+{
+    int tile = (y >> TILE_BITS) * tilesX + (x >> TILE_BITS);
+    return texels[(tile << (2 * TILE_BITS)) + ((y & TILE_MASK) << TILE_BITS) + (x & TILE_MASK)];
+}
+
+static void allocLevel(int w, int h, int & tilesX, std::vector<Vector3f> & texels)
+{
+    tilesX = (w + TILE_MASK) >> TILE_BITS;
+    int tilesY = (h + TILE_MASK) >> TILE_BITS;
+    texels.resize((size_t)tilesX * tilesY * TILE_SIZE * TILE_SIZE);
+}
+
 void
 Texture::load(const char * filename)
 {
-	bimg=new bitmap_image(filename);
-	height = bimg->height();
-    width = bimg->width();
+    bitmap_image bimg(filename);
+    height = bimg.height();
+    width = bimg.width();
+    levels.clear();
+    if(width <= 0 || height <= 0){
+        return;
+    }
+
+    levels.push_back(Level());
+    Level & base = levels.back();
+    base.width = width;
+    base.height = height;
+    allocLevel(width, height, base.tilesX, base.texels);
+    for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+            unsigned char r, g, b;
+            bimg.get_pixel(x, y, r, g, b);
+            base.texel(x, y) = Vector3f(r, g, b) / 255;
+        }
+    }
+
+    // box filter each level down to 1x1, odd sizes clamp at the edge
+    while(levels.back().width > 1 || levels.back().height > 1){
+        Level next;
+        const Level & prev = levels.back();
+        next.width = prev.width > 1 ? prev.width / 2 : 1;
+        next.height = prev.height > 1 ? prev.height / 2 : 1;
+        allocLevel(next.width, next.height, next.tilesX, next.texels);
+        for(int y = 0; y < next.height; y++){
+            int y0 = clampInt(2 * y, 0, prev.height - 1);
+            int y1 = clampInt(2 * y + 1, 0, prev.height - 1);
+            for(int x = 0; x < next.width; x++){
+                int x0 = clampInt(2 * x, 0, prev.width - 1);
+                int x1 = clampInt(2 * x + 1, 0, prev.width - 1);
+                next.texel(x, y) = 0.25f * (prev.texel(x0, y0) + prev.texel(x1, y0)
+                                          + prev.texel(x0, y1) + prev.texel(x1, y1));
+            }
+        }
+        levels.push_back(next);
+    }
 }
 
 void
 Texture::operator()(int x, int y,  unsigned char * color)
 {
-    x = clamp(x,0,width-1);
-    y = clamp(y,0,height-1);
-    bimg->get_pixel(x,y,color[0],color[1],color[2]);
+    x = clampInt(x,0,width-1);
+    y = clampInt(y,0,height-1);
+    const Vector3f & c = levels[0].texel(x, y);
+    for(int ii=0;ii<3;ii++){
+      color[ii] = (unsigned char)(c[ii] * 255 + 0.5f);
+    }
 }
 bool Texture::valid()
 {
-	return bimg!=0;
+	return !levels.empty();
+}
+
+Vector3f
+Texture::bilinear(const Level & level, float x, float y) const
+{
+    x = x * level.width;
+    y = (1 - y) * level.height;
+    int ix = (int)floor(x);
+    int iy = (int)floor(y);
+    float alpha = x - ix;
+    float beta = y - iy;
+    int x0 = clampInt(ix, 0, level.width - 1);
+    int x1 = clampInt(ix + 1, 0, level.width - 1);
+    int y0 = clampInt(iy, 0, level.height - 1);
+    int y1 = clampInt(iy + 1, 0, level.height - 1);
+    return (1-alpha)*(1-beta)*level.texel(x0, y0)
+         +    alpha *(1-beta)*level.texel(x1, y0)
+         + (1-alpha)*   beta *level.texel(x0, y1)
+         +    alpha *   beta *level.texel(x1, y1);
 }
+
 ///@param x assumed to be between 0 and 1
 Vector3f
 Texture::operator()(float x, float y)
 {
-	Vector3f color;
-    int ix,iy;
-    x=x*width;
-    y=(1-y)*height;
-    ix = (int)x;
-    iy = (int)y;
-    unsigned char pixels[4][3];
-    float alpha = x-ix;
-    float beta = y-iy;
-    operator()(ix  ,iy  ,pixels[0]);
-    operator()(ix+1,iy  ,pixels[1]);
-    operator()(ix  ,iy+1,pixels[2]);
-    operator()(ix+1,iy+1,pixels[3]);
-    for(int ii=0;ii<3;ii++){
-      color[ii] = (1-alpha)*(1-beta)*pixels[0][ii]
-                +    alpha *(1-beta)*pixels[1][ii]
-                + (1-alpha)*   beta *pixels[2][ii]
-                +    alpha *   beta *pixels[3][ii];
+    return bilinear(levels[0], x, y);
+}
+
+Vector3f
+Texture::sample(float x, float y, float footprint)
+{
+    // level whose texels are about as wide as the footprint
+    float lod = footprint > 0 ? log2f(footprint * (width > height ? width : height)) : 0;
+    int last = (int)levels.size() - 1;
+    if(lod <= 0){
+        return bilinear(levels[0], x, y);
     }
-	return color/255;
+    if(lod >= last){
+        return bilinear(levels[last], x, y);
+    }
+    int level = (int)lod;
+    float w = lod - level;
+    return (1 - w) * bilinear(levels[level], x, y) + w * bilinear(levels[level + 1], x, y);
 }
 
 Texture::~Texture()
 {
-	if(bimg!=0){
-		delete bimg;
-	}
 }
 
-Texture::Texture():bimg(0),width(0),height(0)
+Texture::Texture():width(0),height(0)
 {
 }
-
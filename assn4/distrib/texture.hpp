@@ -0,0 +1,38 @@
+#ifndef TEXTURE_HPP
+#define TEXTURE_HPP
+#include <vector>
+#include "vecmath.h"
+class bitmap_image;
+///@brief helper class that stores a texture and faciliates lookup
+///The bitmap is converted once at load time into float texels, the
+///stored bytes / 255 with no sRGB decoding since images are written
+///back without encoding, with a full mip chain. Each level is stored in 8x8 texel tiles, so
+///the four texels of a bilinear lookup usually share a cache line.
+class Texture{
+public:
+  Texture();
+  bool valid();
+  void load(const char * filename);
+  ///texel of the finest level as bytes, coordinates are clamped
+  void operator()(int x, int y,  unsigned char * color);
+  ///bilinear lookup in the finest level
+  ///@param x assumed to be between 0 and 1
+  Vector3f operator()(float x, float y);
+  ///trilinear lookup
+  ///@param footprint width of the sampled area in texture coordinates,
+  ///0 samples the finest level
+  Vector3f sample(float x, float y, float footprint);
+  ~Texture();
+private:
+  struct Level{
+    int width, height;
+    int tilesX;
+    std::vector<Vector3f> texels;
+    const Vector3f & texel(int x, int y) const;
+    Vector3f & texel(int x, int y);
+  };
+  Vector3f bilinear(const Level & level, float x, float y) const;
+  std::vector<Level> levels;
+  int width , height;
+};
+#endif